@@ -0,0 +1,158 @@
+/*
+
+Copyright (c) 2002, Calum Robinson
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+* Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+/* Accum.c: a floating point frame to accumulate the smoke in.
+
+   The window's 8 bit buffer is why flurry is held to 60 fps: the fade
+   takes a little off every pixel each frame and the smoke adds a little
+   on, and the faster the frames, the more of both gets lost to rounding
+   until the image either saturates or never fades out.  With -accum the
+   frame is drawn into a half float texture instead, faded by an exact
+   exponential per second (SceneBuild) and shown by drawing it over the
+   whole window, where anything past full brightness is clipped just as
+   the 8 bit buffer would have.  The result no longer depends on the
+   frame rate, so nothing has to hold it down.
+
+   Fixed function GL only, like the rest of the renderer; the buffer
+   needs framebuffer objects and float textures (GL 3.0 or the ARB
+   extensions). */
+
+#define GL_GLEXT_PROTOTYPES
+
+#include <string.h>
+
+#include <flurry.h>
+#include <GL/glext.h>
+
+static int AccumSupported(void)
+{
+    const char *ext = (const char *) glGetString(GL_EXTENSIONS);
+    const char *version = (const char *) glGetString(GL_VERSION);
+
+    if (version && atoi(version) >= 3)
+	return 1;
+    return ext && strstr(ext, "GL_ARB_framebuffer_object") &&
+	strstr(ext, "GL_ARB_texture_float");
+}
+
+int AccumResize(Accum *a, int width, int height)
+{
+    if (a->fbo && a->width == width && a->height == height)
+	return 1;
+    if (!a->fbo) {
+	if (!AccumSupported())
+	    return 0;
+	glGenTextures(1, &a->texture);
+	glGenFramebuffers(1, &a->fbo);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, a->texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0,
+		 GL_RGBA, GL_FLOAT, NULL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, a->fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			   GL_TEXTURE_2D, a->texture, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	AccumFree(a);
+	return 0;
+    }
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    a->width = width;
+    a->height = height;
+    return 1;
+}
+
+void AccumFree(Accum *a)
+{
+    if (a->fbo)
+	glDeleteFramebuffers(1, &a->fbo);
+    if (a->texture)
+	glDeleteTextures(1, &a->texture);
+    memset(a, 0, sizeof(Accum));
+}
+
+void AccumBegin(Accum *a)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, a->fbo);
+}
+
+/* back to the window, and the frame onto it */
+void AccumEnd(Accum *a)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDrawBuffer(GL_BACK);
+    glViewport(0, 0, a->width, a->height);
+
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+
+    glDisable(GL_BLEND);
+    glDisable(GL_ALPHA_TEST);
+    glEnable(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, a->texture);
+    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+
+    glBegin(GL_QUADS);
+    glTexCoord2f(0.0f, 0.0f); glVertex2f(-1.0f, -1.0f);
+    glTexCoord2f(1.0f, 0.0f); glVertex2f(1.0f, -1.0f);
+    glTexCoord2f(1.0f, 1.0f); glVertex2f(1.0f, 1.0f);
+    glTexCoord2f(0.0f, 1.0f); glVertex2f(-1.0f, 1.0f);
+    glEnd();
+
+    glEnableClientState(GL_COLOR_ARRAY);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glDisable(GL_TEXTURE_2D);
+    glEnable(GL_ALPHA_TEST);
+    glEnable(GL_BLEND);
+
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    glPopMatrix();
+}
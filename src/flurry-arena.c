@@ -0,0 +1,135 @@
+/*
+
+Copyright (c) 2002, Calum Robinson
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+* Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/* Arena.c: one block of memory per flurry.
+
+   A flurry's flurry_info_t, star, sparks and smoke are laid out back to
+   back in a single anonymous mapping, with only as many sparks as the
+   flurry has streams.  Building or tearing down a preset is then one
+   mmap or munmap per flurry rather than a trail of mallocs, and a flurry's
+   state stays together instead of being spread over the heap.  The
+   snapshot file (flurry-snapshot.c) stores each flurry in this same
+   layout, so a loaded flurry is just a block that lives in the file.
+
+   With -hugepages a block is rounded up to a 2 MB huge page: from the
+   hugetlb pool if there is one, otherwise as an aligned mapping that
+   transparent huge pages may back.  A full SmokeV is about 230 KB, so
+   this trades memory for TLB reach and only pays off on large presets. */
+
+#include <sys/mman.h>
+#include <stdint.h>
+
+#include <flurry.h>
+
+#define ARENA_ALIGN 64
+#define ARENA_PAGE  4096
+#define ARENA_HUGE  (2 * 1024 * 1024)
+
+#define ROUND(x, a) (((x) + (a) - 1) & ~((size_t) (a) - 1))
+
+int arenaHugePages = 0;
+
+/* where each part of a flurry lives inside its block */
+#define OFF_STAR  ROUND(sizeof(flurry_info_t), ARENA_ALIGN)
+#define OFF_SPARK (OFF_STAR + ROUND(sizeof(Star), ARENA_ALIGN))
+#define OFF_SMOKE(streams) \
+	(OFF_SPARK + ROUND((streams) * sizeof(Spark), ARENA_ALIGN))
+
+size_t FlurryBlockSize(int streams)
+{
+    return ROUND(OFF_SMOKE(streams) + sizeof(SmokeV), ARENA_PAGE);
+}
+
+void FlurryBlockBind(flurry_info_t *flurry)
+{
+    char *base = (char *) flurry;
+
+    flurry->star = (Star *) (base + OFF_STAR);
+    flurry->spark = (Spark *) (base + OFF_SPARK);
+    flurry->s = (SmokeV *) (base + OFF_SMOKE(flurry->numStreams));
+}
+
+static void *ArenaMapHuge(size_t size)
+{
+    char *p, *aligned;
+
+#ifdef MAP_HUGETLB
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+	     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED)
+	return p;
+#endif
+
+    /* no hugetlb pool: over-map, trim to a 2 MB boundary and ask for THP */
+    p = mmap(NULL, size + ARENA_HUGE, PROT_READ | PROT_WRITE,
+	     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+	return NULL;
+    aligned = (char *) ROUND((uintptr_t) p, ARENA_HUGE);
+    if (aligned > p)
+	munmap(p, aligned - p);
+    munmap(aligned + size, p + ARENA_HUGE - aligned);
+#ifdef MADV_HUGEPAGE
+    madvise(aligned, size, MADV_HUGEPAGE);
+#endif
+    return aligned;
+}
+
+flurry_info_t *FlurryBlockAlloc(int streams)
+{
+    flurry_info_t *flurry;
+    size_t size = FlurryBlockSize(streams);
+
+    if (arenaHugePages) {
+	size = ROUND(size, ARENA_HUGE);
+	flurry = ArenaMapHuge(size);
+    } else {
+	flurry = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (flurry == MAP_FAILED)
+	    flurry = NULL;
+    }
+    if (!flurry)
+	return NULL;
+
+    /* anonymous memory comes zeroed */
+    flurry->numStreams = streams;
+    flurry->blockSize = size;
+    FlurryBlockBind(flurry);
+    return flurry;
+}
+
+void FlurryBlockFree(flurry_info_t *flurry)
+{
+    if (flurry->blockSize)
+	munmap(flurry, flurry->blockSize);
+}
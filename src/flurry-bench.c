@@ -0,0 +1,594 @@
+/*
+
+Copyright (c) 2002, Calum Robinson
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+* Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/* Bench.c: headless scaling sweep.
+
+   Runs every combination of the requested presets (or synthetic
+   flurries x streams configurations), kernels, particle caps, screen
+   sizes and thread counts for a fixed number of frames, on a fixed time
+   step and from a fixed seed, and writes one CSV row per combination:
+   frame time percentiles, the per-phase split and how many particles
+   and quads the frames carried.  A run starts with a warm-up so the
+   screen is full before anything is measured.
+
+   There is no GL context, so a frame here is the CPU side only: the
+   simulation and the vertex build, which is what DrawSmoke leaves for
+   SubmitSmoke.  With more than one thread the flurries are dealt out
+   round-robin and each frame ends at a barrier; every flurry draws from
+   its own generator, so those runs are bit for bit the same as on one
+   thread.  The frame times are wall clock, step_ms and verts_ms are
+   summed over threads, and the star/spark/smoke split is only filled in
+   on one thread.  So are the -counters columns: instructions per cycle,
+   cache and branch misses per particle and the stalled share of the
+   cycles, for the simulation and for the vertex build.
+
+   -prep n builds each flurry's quads on n threads (flurry-prep.c); the
+   rows say how many, and verts_ms is then the wall time of the build.
+   -fused updates and draws the smoke in one pass (UpdateDrawSmoke), so
+   the vertex build is counted in step_ms and verts_ms is 0.
+
+   A -field run samples the sparks' pull on a grid (flurry-field.c), to
+   within 5% RMS of the exact pull at n = 8 and 3.5% from n = 12.  Its
+   rows carry what it came to on each frame's particles, measured outside
+   the timing, and field_from, the fewest streams from which the grid
+   beats the row's kernel (empty if it never does); below that the
+   flurries keep the exact update.  The synthetic -streams flurries may
+   go past a scene's MAX_SPARKS, for the field's sake. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <flurry.h>
+
+#define BENCH_MAX_LIST 16
+#define BENCH_MAX_THREADS 64
+
+typedef struct BenchList
+{
+    int n;
+    float v[BENCH_MAX_LIST];
+    float w[BENCH_MAX_LIST];	/* heights, for -res */
+} BenchList;
+
+typedef struct BenchOptions
+{
+    int frames;
+    int warmup;
+    unsigned int seed;
+    double dt;
+    int counters;
+    int prep;		/* threads per vertex build */
+    int fused;
+    BenchList presets;	/* preset numbers */
+    BenchList modes;
+    BenchList streams;	/* synthetic configurations, with flurries */
+    BenchList flurries;
+    BenchList caps;	/* fraction of NUMSMOKEPARTICLES */
+    BenchList fields;	/* grid nodes a side; 0 is the exact pull */
+    BenchList res;
+    BenchList threads;
+} BenchOptions;
+
+/* one combination being measured */
+typedef struct BenchRun
+{
+    global_info_t global;
+    int numFlurries;
+    flurry_info_t **flurry;
+    int threads;
+    double now;
+    double brite;
+} BenchRun;
+
+typedef struct BenchWorker
+{
+    pthread_t thread;
+    BenchRun *run;
+    int index;
+    SmokeStaging staging;
+    double step, verts;		/* seconds, this frame */
+    int live, quads;
+} BenchWorker;
+
+static BenchWorker workers[BENCH_MAX_THREADS];
+static pthread_barrier_t frameStart, frameDone;
+static volatile int benchQuit;
+
+static void BenchFlurries(BenchWorker *w)
+{
+    BenchRun *run = w->run;
+    double t0, t1, t2, tv;
+    int n;
+
+    w->step = w->verts = 0.0;
+    w->live = w->quads = 0;
+    for (n = w->index; n < run->numFlurries; n += run->threads) {
+	flurry_info_t *flurry = run->flurry[n];
+
+	t0 = ProfileClock();
+	if (run->global.fusedSmoke) {
+	    w->quads += StepDrawFlurry(&run->global, flurry, run->now, &w->staging,
+				       run->brite * flurry->briteFactor);
+	    t1 = t2 = ProfileClock();
+	} else {
+	    StepFlurry(&run->global, flurry, run->now);
+	    t1 = ProfileClock();
+	    PROFILE_BEGIN(PHASE_VERTS, tv);
+	    w->quads += DrawSmoke(&run->global, flurry, flurry->s, &w->staging,
+				  run->brite * flurry->briteFactor);
+	    PROFILE_END(PHASE_VERTS, tv);
+	    t2 = ProfileClock();
+	}
+	w->step += t1 - t0;
+	w->verts += t2 - t1;
+	w->live += flurry->s->live;
+    }
+}
+
+static void *BenchThread(void *arg)
+{
+    BenchWorker *w = arg;
+
+    for (;;) {
+	pthread_barrier_wait(&frameStart);
+	if (benchQuit)
+	    break;
+	BenchFlurries(w);
+	pthread_barrier_wait(&frameDone);
+    }
+    return NULL;
+}
+
+static int compareDouble(const void *a, const void *b)
+{
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+static int BenchCreate(BenchRun *run, const BenchOptions *opts, int preset,
+		       int streams, int flurries, int mode, float cap, int field,
+		       float width, float height)
+{
+    flurry_info_t *flurry;
+    int i;
+
+    memset(run, 0, sizeof(BenchRun));
+    run->global.optMode = mode;
+    run->global.fieldGrid = field;
+    FieldFrom(field, mode);
+    run->global.fusedSmoke = opts->fused;
+    run->global.sys_glWidth = width;
+    run->global.sys_glHeight = height;
+
+    RngSeed(&run->global.rng, opts->seed);
+    if (preset != PRESET_UNKNOWN) {
+	if (!CreatePreset(&run->global, preset, 0.0))
+	    return 0;
+    } else {
+	/* the flurries of the insane preset, n at a time */
+	for (i = 0; i < flurries; i++) {
+	    if (!(flurry = new_flurry_info(&run->global, streams, tiedyeColorMode,
+					   1000.0, 0.5 + i * 0.25, 0.5, 0.0)))
+		break;
+	    flurry->next = run->global.flurry;
+	    run->global.flurry = flurry;
+	}
+    }
+
+    for (flurry = run->global.flurry; flurry; flurry = flurry->next)
+	run->numFlurries++;
+    if (!(run->flurry = calloc(run->numFlurries, sizeof(flurry_info_t *))))
+	return 0;
+    for (flurry = run->global.flurry, i = 0; flurry; flurry = flurry->next, i++) {
+	run->flurry[i] = flurry;
+	SetSmokeCap(flurry->s, (int) (cap * (NUMSMOKEPARTICLES/4)));
+    }
+    return 1;
+}
+
+static void BenchDestroy(BenchRun *run)
+{
+    flurry_info_t *flurry;
+
+    while ((flurry = run->global.flurry)) {
+	run->global.flurry = flurry->next;
+	delete_flurry_info(flurry);
+    }
+    free(run->flurry);
+}
+
+static void BenchHeader(FILE *out, int counters)
+{
+    fprintf(out, "preset,streams,flurries,kernel,cap,field,width,height,threads,prep,fused,frames,"
+	    "particles,quads,mean_ms,p50_ms,p90_ms,p99_ms,max_ms,"
+	    "step_ms,verts_ms,star_ms,spark_ms,smoke_ms,field_rms,field_p99,field_from%s\n",
+	    counters ?
+	    ",sim_ipc,sim_miss_pp,sim_brmiss_pp,sim_stall,"
+	    "verts_ipc,verts_miss_pp,verts_brmiss_pp,verts_stall" : "");
+}
+
+/* the -counters columns; left empty for whatever wasn't counted */
+static void BenchCounters(FILE *out, int valid,
+			  const unsigned long long sim[COUNTER_MAX],
+			  const unsigned long long verts[COUNTER_MAX],
+			  double particles)
+{
+    CounterRatios r;
+    double v[4];
+    int i, k;
+
+    for (i = 0; i < 2; i++) {
+	r.ipc = r.missesPerParticle = r.branchMissesPerParticle = r.stalled = -1.0;
+	if (valid)
+	    CounterRatiosOf(i ? verts : sim, particles, &r);
+	v[0] = r.ipc;
+	v[1] = r.missesPerParticle;
+	v[2] = r.branchMissesPerParticle;
+	v[3] = r.stalled;
+	for (k = 0; k < 4; k++)
+	    if (v[k] >= 0.0)
+		fprintf(out, ",%.4f", v[k]);
+	    else
+		fprintf(out, ",");
+    }
+}
+
+static int BenchOne(const BenchOptions *opts, FILE *out, int preset,
+		    int streams, int flurries, int mode, float cap, int field,
+		    float width, float height, int threads)
+{
+    static BenchRun run;
+    double *frameTime, phase[PHASE_MAX], phaseSum[PHASE_MAX];
+    unsigned long long counts[PHASE_MAX][COUNTER_MAX];
+    unsigned long long simCount[COUNTER_MAX], vertsCount[COUNTER_MAX];
+    double step = 0.0, verts = 0.0, sum = 0.0, t0;
+    double particles = 0.0, quads = 0.0;
+    double fieldRms = 0.0, rms, fieldWeight = 0.0;
+    float fieldP99 = 0.0f, p99;
+    int frame, i, k, n, w, total = opts->warmup + opts->frames;
+
+    if (!BenchCreate(&run, opts, preset, streams, flurries, mode, cap, field,
+		     width, height))
+	return 0;
+    if (!(frameTime = calloc(opts->frames, sizeof(double)))) {
+	BenchDestroy(&run);
+	return 0;
+    }
+    run.threads = threads;
+
+    for (w = 0; w < threads; w++) {
+	workers[w].run = &run;
+	workers[w].index = w;
+	if (!workers[w].staging.quads &&
+	    !InitSmokeStaging(&workers[w].staging, NUMSMOKEPARTICLES))
+	    return 0;
+    }
+    if (threads > 1) {
+	benchQuit = 0;
+	pthread_barrier_init(&frameStart, NULL, threads);
+	pthread_barrier_init(&frameDone, NULL, threads);
+	for (w = 1; w < threads; w++)
+	    pthread_create(&workers[w].thread, NULL, BenchThread, &workers[w]);
+    }
+
+    /* the phase split only adds up on one thread */
+    profileEnabled = threads == 1;
+    memset(phaseSum, 0, sizeof(phaseSum));
+    memset(simCount, 0, sizeof(simCount));
+    memset(vertsCount, 0, sizeof(vertsCount));
+    for (frame = 0; frame < total; frame++) {
+	run.now = (frame + 1) * opts->dt;
+	run.brite = pow(opts->dt, 0.75) * 10;
+
+	t0 = ProfileClock();
+	if (threads > 1)
+	    pthread_barrier_wait(&frameStart);
+	BenchFlurries(&workers[0]);
+	if (threads > 1)
+	    pthread_barrier_wait(&frameDone);
+	t0 = ProfileClock() - t0;
+	ProfileTakeFrame(phase);
+	if (countersEnabled)
+	    CountersTakeFrame(counts);
+
+	if (frame < opts->warmup)
+	    continue;
+	for (k = 0; countersEnabled && k < COUNTER_MAX; k++) {
+	    simCount[k] += counts[PHASE_STAR][k] + counts[PHASE_SPARK][k] +
+		counts[PHASE_SMOKE][k];
+	    vertsCount[k] += counts[PHASE_VERTS][k];
+	}
+	frameTime[frame - opts->warmup] = t0;
+	sum += t0;
+	for (i = 0; i < PHASE_MAX; i++)
+	    phaseSum[i] += phase[i];
+	for (w = 0; w < threads; w++) {
+	    step += workers[w].step;
+	    verts += workers[w].verts;
+	    particles += workers[w].live;
+	    quads += workers[w].quads;
+	}
+	for (i = 0; field && i < run.numFlurries; i++) {
+	    if (!(n = FieldError(run.flurry[i], field, &rms, &p99)))
+		continue;
+	    fieldRms += rms * rms * n;
+	    fieldWeight += n;
+	    fieldP99 = MAX_(fieldP99, p99);
+	}
+    }
+    profileEnabled = 0;
+
+    if (threads > 1) {
+	benchQuit = 1;
+	pthread_barrier_wait(&frameStart);
+	for (w = 1; w < threads; w++)
+	    pthread_join(workers[w].thread, NULL);
+	pthread_barrier_destroy(&frameStart);
+	pthread_barrier_destroy(&frameDone);
+    }
+
+    qsort(frameTime, opts->frames, sizeof(double), compareDouble);
+
+#define MS(x) ((x) * 1000.0 / opts->frames)
+#define PCT(p) (frameTime[(opts->frames - 1) * (p) / 100] * 1000.0)
+    fprintf(out, "%s,%d,%d,%s,%.3f,%d,%d,%d,%d,%d,%d,%d,%.0f,%.0f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,",
+	    preset != PRESET_UNKNOWN ? PresetName(preset) : "custom",
+	    run.flurry[0]->numStreams, run.numFlurries, OptModeName(mode),
+	    cap, field, (int) width, (int) height, threads, MAX_(1, prepThreads),
+	    opts->fused, opts->frames,
+	    particles / opts->frames, quads / opts->frames,
+	    MS(sum), PCT(50), PCT(90), PCT(99),
+	    frameTime[opts->frames - 1] * 1000.0, MS(step), MS(verts));
+    if (threads == 1)
+	fprintf(out, "%.4f,%.4f,%.4f", MS(phaseSum[PHASE_STAR]),
+		MS(phaseSum[PHASE_SPARK]), MS(phaseSum[PHASE_SMOKE]));
+    else
+	fprintf(out, ",,");
+    /* the worst frame's p99, and the rms over every particle */
+    if (fieldWeight > 0.0)
+	fprintf(out, ",%.5f,%.5f", sqrt(fieldRms / fieldWeight), fieldP99);
+    else
+	fprintf(out, ",,");
+    if (field && FieldFrom(field, mode) <= MAX_BENCH_SPARKS)
+	fprintf(out, ",%d", FieldFrom(field, mode));
+    else
+	fprintf(out, ",");
+    if (opts->counters)
+	BenchCounters(out, threads == 1 && countersEnabled, simCount,
+		      vertsCount, particles);
+    fprintf(out, "\n");
+#undef PCT
+#undef MS
+    fflush(out);
+
+    free(frameTime);
+    BenchDestroy(&run);
+    return 1;
+}
+
+static int BenchParseList(BenchList *l, char *arg, int res)
+{
+    char *tok, *x;
+
+    l->n = 0;
+    for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+	if (l->n == BENCH_MAX_LIST)
+	    return 0;
+	if (res) {
+	    if (!(x = strchr(tok, 'x')))
+		return 0;
+	    l->w[l->n] = atof(x + 1);
+	}
+	l->v[l->n++] = atof(tok);
+    }
+    return l->n > 0;
+}
+
+static int BenchParseNames(BenchList *l, char *arg, int presets)
+{
+    char *tok;
+    int v;
+
+    l->n = 0;
+    for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+	if (!strcmp(tok, "none"))
+	    continue;
+	if (l->n == BENCH_MAX_LIST)
+	    return 0;
+	if (presets) {
+	    if (!strcmp(tok, "random") ||
+		(v = ParsePreset(tok)) == PRESET_UNKNOWN)
+		return 0;
+	} else {
+	    if ((v = ParseOptMode(tok)) < 0)
+		return 0;
+	    if (!OptModeSupported(v)) {
+		fprintf(stderr, "bench: kernel %s not available, skipped\n", tok);
+		continue;
+	    }
+	}
+	l->v[l->n++] = v;
+    }
+    return 1;
+}
+
+static int BenchUsage(void)
+{
+    fprintf(stderr,
+	    "usage: flurry -bench [-presets a,b|all|none] [-modes a,b|all]\n"
+	    "                     [-streams n,n -flurries n,n] [-caps f,f]\n"
+	    "                     [-field n,n]\n"
+	    "                     [-res WxH,WxH] [-threads n,n] [-frames n]\n"
+	    "                     [-warmup n] [-dt s] [-seed n] [-prep n] [-fused]\n"
+	    "                     [-counters] [-o file.csv]\n"
+	    "  -streams   also run synthetic configurations of each -flurries\n"
+	    "             count of flurries with this many streams (1..%d)\n"
+	    "  -caps      particle cap as a fraction of the full %d\n"
+	    "  -field     also sample the sparks' pull on n^3 grid nodes (2..%d),\n"
+	    "             within 5%% RMS at 8 and 3.5%% from 12, wherever it beats\n"
+	    "             the kernel; 0 is the exact pull\n"
+	    "  -prep      threads building each flurry's quads\n"
+	    "  -fused     update and draw the smoke in one pass\n"
+	    "  -counters  hardware counters per particle (single thread rows)\n",
+	    MAX_BENCH_SPARKS, NUMSMOKEPARTICLES, FIELD_MAX_GRID);
+    return 2;
+}
+
+int BenchMain(int argc, char **argv)
+{
+    BenchOptions opts;
+    FILE *out = stdout;
+    const char *path = NULL;
+    int i, p, m, s, f, c, g, r, t, ok = 1;
+
+    memset(&opts, 0, sizeof(opts));
+    opts.frames = 600;
+    opts.warmup = 180;
+    opts.seed = 1;
+    opts.dt = 1.0 / 60.0;
+    for (p = PRESET_INSANE; p < PRESET_MAX; p++)
+	opts.presets.v[opts.presets.n++] = p;
+    for (m = 0; m < OPT_MODE_MAX; m++)
+	if (OptModeSupported(m))
+	    opts.modes.v[opts.modes.n++] = m;
+    opts.flurries.n = 1;
+    opts.flurries.v[0] = 1;
+    opts.caps.n = 1;
+    opts.caps.v[0] = 1.0f;
+    opts.fields.n = 1;
+    opts.fields.v[0] = 0;
+    opts.res.n = 1;
+    opts.res.v[0] = 1920.0f;
+    opts.res.w[0] = 1080.0f;
+    opts.threads.n = 1;
+    opts.threads.v[0] = 1;
+
+    for (i = 1; i < argc; i++) {
+	if (!strcmp(argv[i], "-presets") && i + 1 < argc) {
+	    if (strcmp(argv[++i], "all") && !BenchParseNames(&opts.presets, argv[i], 1))
+		return BenchUsage();
+	} else if (!strcmp(argv[i], "-modes") && i + 1 < argc) {
+	    if (strcmp(argv[++i], "all") && !BenchParseNames(&opts.modes, argv[i], 0))
+		return BenchUsage();
+	} else if (!strcmp(argv[i], "-streams") && i + 1 < argc) {
+	    if (!BenchParseList(&opts.streams, argv[++i], 0))
+		return BenchUsage();
+	} else if (!strcmp(argv[i], "-flurries") && i + 1 < argc) {
+	    if (!BenchParseList(&opts.flurries, argv[++i], 0))
+		return BenchUsage();
+	} else if (!strcmp(argv[i], "-caps") && i + 1 < argc) {
+	    if (!BenchParseList(&opts.caps, argv[++i], 0))
+		return BenchUsage();
+	} else if (!strcmp(argv[i], "-field") && i + 1 < argc) {
+	    if (!BenchParseList(&opts.fields, argv[++i], 0))
+		return BenchUsage();
+	} else if (!strcmp(argv[i], "-res") && i + 1 < argc) {
+	    if (!BenchParseList(&opts.res, argv[++i], 1))
+		return BenchUsage();
+	} else if (!strcmp(argv[i], "-threads") && i + 1 < argc) {
+	    if (!BenchParseList(&opts.threads, argv[++i], 0))
+		return BenchUsage();
+	} else if (!strcmp(argv[i], "-frames") && i + 1 < argc) {
+	    opts.frames = atoi(argv[++i]);
+	} else if (!strcmp(argv[i], "-warmup") && i + 1 < argc) {
+	    opts.warmup = atoi(argv[++i]);
+	} else if (!strcmp(argv[i], "-dt") && i + 1 < argc) {
+	    opts.dt = atof(argv[++i]);
+	} else if (!strcmp(argv[i], "-seed") && i + 1 < argc) {
+	    opts.seed = strtoul(argv[++i], NULL, 0);
+	} else if (!strcmp(argv[i], "-prep") && i + 1 < argc) {
+	    opts.prep = atoi(argv[++i]);
+	} else if (!strcmp(argv[i], "-fused")) {
+	    opts.fused = 1;
+	} else if (!strcmp(argv[i], "-counters")) {
+	    opts.counters = 1;
+	} else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+	    path = argv[++i];
+	} else {
+	    return BenchUsage();
+	}
+    }
+
+    if (opts.frames <= 0 || opts.warmup < 0 || opts.dt <= 0.0)
+	return BenchUsage();
+    for (i = 0; i < opts.streams.n; i++)
+	if (opts.streams.v[i] < 1 || opts.streams.v[i] > MAX_BENCH_SPARKS)
+	    return BenchUsage();
+    for (i = 0; i < opts.fields.n; i++)
+	if (opts.fields.v[i] != 0 && !FieldGridValid((int) opts.fields.v[i]))
+	    return BenchUsage();
+    for (i = 0; i < opts.threads.n; i++)
+	if (opts.threads.v[i] < 1 || opts.threads.v[i] > BENCH_MAX_THREADS)
+	    return BenchUsage();
+
+    if (path && !(out = fopen(path, "w"))) {
+	perror(path);
+	return 2;
+    }
+    if (opts.prep > 1 && !PrepStart(opts.prep))
+	return 1;
+    /* the columns stay even if the counters can't be had */
+    if (opts.counters)
+	CountersOpen();
+    BenchHeader(out, opts.counters);
+
+    /* the presets first, then the synthetic configurations */
+    for (p = 0; p < opts.presets.n + opts.streams.n * opts.flurries.n; p++)
+	for (m = 0; m < opts.modes.n; m++)
+	    for (c = 0; c < opts.caps.n; c++)
+	      for (g = 0; g < opts.fields.n; g++)
+		for (r = 0; r < opts.res.n; r++)
+		    for (t = 0; t < opts.threads.n; t++) {
+			int preset = PRESET_UNKNOWN, streams = 0, flurries = 0;
+
+			if (p < opts.presets.n) {
+			    preset = (int) opts.presets.v[p];
+			} else {
+			    s = (p - opts.presets.n) / opts.flurries.n;
+			    f = (p - opts.presets.n) % opts.flurries.n;
+			    streams = (int) opts.streams.v[s];
+			    flurries = (int) opts.flurries.v[f];
+			}
+			ok &= BenchOne(&opts, out, preset, streams, flurries,
+				       (int) opts.modes.v[m], opts.caps.v[c],
+				       (int) opts.fields.v[g], opts.res.v[r], opts.res.w[r],
+				       (int) opts.threads.v[t]);
+		    }
+
+    if (path && fclose(out)) {
+	perror(path);
+	ok = 0;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,234 @@
+/*
+
+Copyright (c) 2002, Calum Robinson
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+* Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/* Counters.c: hardware performance counters around the profiled phases.
+
+   With -counters (or -bench -counters) each thread that runs a phase
+   opens one perf_event_open group: cycles, instructions, cache misses,
+   branch misses and backend stall cycles, user space only.  Reading the
+   group when a phase begins and ends gives the phase's share, scaled up
+   if the kernel had to multiplex the group.  A counter the CPU does not
+   have is simply left out; if the leader cannot be opened at all (no
+   PMU, perf_event_paranoid, seccomp) the counters switch themselves off
+   and say why, once.
+
+   Like the phase timings these are per frame totals, and they only add
+   up when one thread runs each phase.  Each thread adds into its own
+   group; CountersPublish hands them over, as ProfilePublish does the
+   timings. */
+
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <flurry.h>
+
+int countersEnabled = 0;
+
+static const char *counterNames[COUNTER_MAX] = {
+    "cycles", "instructions", "cache-misses", "branch-misses", "stalled-cycles"
+};
+
+static const unsigned long long counterConfig[COUNTER_MAX] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES,
+    PERF_COUNT_HW_STALLED_CYCLES_BACKEND
+};
+
+/* what a PERF_FORMAT_GROUP read with both times returns */
+typedef struct CounterRead
+{
+    unsigned long long nr;
+    unsigned long long enabled;
+    unsigned long long running;
+    unsigned long long value[COUNTER_MAX];
+} CounterRead;
+
+/* one group per thread; kind[i] is what value[i] of a read counts */
+typedef struct CounterGroup
+{
+    int fd;			/* leader, -1 when not open */
+    int n;
+    int kind[COUNTER_MAX];
+    CounterRead start[PHASE_MAX];
+    unsigned long long current[PHASE_MAX][COUNTER_MAX];
+} CounterGroup;
+
+static __thread CounterGroup *counterSelf;
+static int counterAvailable[COUNTER_MAX];	/* opened on some thread */
+static volatile int counterWarned = 0;
+
+static unsigned long long counterPublished[PHASE_MAX][COUNTER_MAX];
+static pthread_mutex_t counterLock = PTHREAD_MUTEX_INITIALIZER;
+
+static int CounterOpen(int kind, int group)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = counterConfig[kind];
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+	PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.disabled = group < 0;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+static CounterGroup *CounterThread(void)
+{
+    CounterGroup *g;
+    int i, fd;
+
+    if (counterSelf)
+	return counterSelf->fd >= 0 ? counterSelf : NULL;
+    if (!(g = calloc(1, sizeof(CounterGroup))))
+	return NULL;
+    counterSelf = g;
+
+    if ((g->fd = CounterOpen(COUNTER_CYCLES, -1)) < 0) {
+	if (!counterWarned) {
+	    counterWarned = 1;
+	    fprintf(stderr, "counters: can't open %s: %s; carrying on without\n",
+		    counterNames[COUNTER_CYCLES], strerror(errno));
+	}
+	countersEnabled = 0;
+	return NULL;
+    }
+    g->kind[g->n++] = COUNTER_CYCLES;
+    counterAvailable[COUNTER_CYCLES] = 1;
+
+    for (i = COUNTER_CYCLES + 1; i < COUNTER_MAX; i++) {
+	if ((fd = CounterOpen(i, g->fd)) < 0)
+	    continue;
+	g->kind[g->n++] = i;
+	counterAvailable[i] = 1;
+    }
+
+    ioctl(g->fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(g->fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return g;
+}
+
+static int CounterSample(CounterGroup *g, CounterRead *r)
+{
+    return read(g->fd, r, sizeof(CounterRead)) >= (ssize_t) (3 + g->n) * 8;
+}
+
+int CountersOpen(void)
+{
+    countersEnabled = 1;
+    return CounterThread() != NULL;
+}
+
+int CounterAvailable(CounterKind kind)
+{
+    return counterAvailable[kind];
+}
+
+void CountersBegin(ProfilePhase phase)
+{
+    CounterGroup *g = CounterThread();
+
+    if (g && !CounterSample(g, &g->start[phase]))
+	g->start[phase].nr = 0;
+}
+
+void CountersEnd(ProfilePhase phase)
+{
+    CounterGroup *g = CounterThread();
+    CounterRead now, *then;
+    double scale;
+    int i;
+
+    if (!g || !CounterSample(g, &now))
+	return;
+    then = &g->start[phase];
+    if (!then->nr || now.running == then->running)
+	return;
+
+    /* the group was only on the PMU for part of the phase */
+    scale = (double) (now.enabled - then->enabled) / (now.running - then->running);
+    for (i = 0; i < g->n; i++)
+	g->current[phase][g->kind[i]] +=
+	    (unsigned long long) ((now.value[i] - then->value[i]) * scale);
+}
+
+void CountersPublish(void)
+{
+    CounterGroup *g = counterSelf;
+    int i, k;
+
+    if (!g)
+	return;
+    pthread_mutex_lock(&counterLock);
+    for (i = 0; i < PHASE_MAX; i++)
+	for (k = 0; k < COUNTER_MAX; k++)
+	    counterPublished[i][k] += g->current[i][k];
+    pthread_mutex_unlock(&counterLock);
+    memset(g->current, 0, sizeof(g->current));
+}
+
+void CountersTakeFrame(unsigned long long counts[PHASE_MAX][COUNTER_MAX])
+{
+    CountersPublish();
+    pthread_mutex_lock(&counterLock);
+    memcpy(counts, counterPublished, sizeof(counterPublished));
+    memset(counterPublished, 0, sizeof(counterPublished));
+    pthread_mutex_unlock(&counterLock);
+}
+
+void CounterRatiosOf(const unsigned long long counts[COUNTER_MAX],
+		     double particles, CounterRatios *r)
+{
+    double cycles = counts[COUNTER_CYCLES];
+
+    r->ipc = r->missesPerParticle = r->branchMissesPerParticle = r->stalled = -1.0;
+    if (counterAvailable[COUNTER_INSTRUCTIONS] && cycles > 0.0)
+	r->ipc = counts[COUNTER_INSTRUCTIONS] / cycles;
+    if (counterAvailable[COUNTER_STALLED] && cycles > 0.0)
+	r->stalled = counts[COUNTER_STALLED] / cycles;
+    if (particles <= 0.0)
+	return;
+    if (counterAvailable[COUNTER_CACHE_MISSES])
+	r->missesPerParticle = counts[COUNTER_CACHE_MISSES] / particles;
+    if (counterAvailable[COUNTER_BRANCH_MISSES])
+	r->branchMissesPerParticle = counts[COUNTER_BRANCH_MISSES] / particles;
+}
@@ -0,0 +1,219 @@
+/*
+
+Copyright (c) 2002, Calum Robinson
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+* Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/* Cpu.c: run-time selection of the smoke kernels.
+
+   One binary carries a build of the kernels for each instruction set
+   (flurry-smoke-vector.c).  Which one is fastest depends on the flurry:
+   the wide kernels gather and scatter a vector's particle groups one by
+   one, which only pays for itself when there are enough streams in the
+   spark loop to spread it over.  So by default (OPT_MODE_AUTO) every
+   kernel the CPU and OS support is timed once, on the first use, with
+   a synthetic flurry of 1, 2, 4 ... 64 streams, and each flurry gets the
+   narrowest kernel that won for its stream count.  FLURRY_KERNEL (scalar,
+   vector, avx2, avx512 or auto) overrides that. */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <flurry.h>
+
+/* the stream counts timed, and the rounds of each; a wider kernel has to
+   win by OPT_MODE_MARGIN to be picked over a narrower one */
+#define OPT_MODE_PROBES 7
+#define OPT_MODE_ROUNDS 3
+#define OPT_MODE_MARGIN 0.95
+
+static const char *optModeNames[OPT_MODE_MAX + 1] = {
+    "scalar", "vector", "avx2", "avx512", "auto"
+};
+
+static pthread_once_t optModeOnce = PTHREAD_ONCE_INIT;
+static int optModeFor[OPT_MODE_PROBES];	/* by log2 of the stream count */
+
+const char *OptModeName(int mode)
+{
+    if (mode < 0 || mode > OPT_MODE_AUTO)
+	return "unknown";
+    return optModeNames[mode];
+}
+
+int ParseOptMode(const char *name)
+{
+    int mode;
+
+    for (mode = 0; mode <= OPT_MODE_AUTO; mode++)
+	if (!strcmp(name, optModeNames[mode]))
+	    return mode;
+    return -1;
+}
+
+int OptModeSupported(int mode)
+{
+    switch (mode) {
+    case OPT_MODE_SCALAR_BASE:
+    case OPT_MODE_VECTOR:
+    case OPT_MODE_AUTO:
+	return 1;
+#ifdef FLURRY_X86_KERNELS
+    case OPT_MODE_VECTOR_AVX2:
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+    case OPT_MODE_VECTOR_AVX512:
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx512f");
+#endif
+    default:
+	return 0;
+    }
+}
+
+int SelectOptMode(void)
+{
+    const char *name = getenv("FLURRY_KERNEL");
+    int mode;
+
+    if (name && *name) {
+	if ((mode = ParseOptMode(name)) < 0)
+	    fprintf(stderr, "flurry: unknown FLURRY_KERNEL \"%s\"\n", name);
+	else if (!OptModeSupported(mode))
+	    fprintf(stderr, "flurry: FLURRY_KERNEL=%s is not supported "
+		    "by this CPU\n", name);
+	else
+	    return mode;
+    }
+    /* time them now rather than in the middle of the first frame */
+    OptModeForStreams(1);
+    return OPT_MODE_AUTO;
+}
+
+/* every live lane near its own spark, moving, and just born */
+static void OptModeFill(flurry_info_t *flurry, FlurryRng *rng)
+{
+    SmokeV *s = flurry->s;
+    int i, k, a;
+
+    for (i = 0; i < s->numGroups; i++) {
+	for (k = 0; k < 4; k++) {
+	    const Spark *spark = &flurry->spark[(i * 4 + k) % flurry->numStreams];
+
+	    for (a = 0; a < 3; a++) {
+		float jitter = (float) (RngNext(rng) % 400) - 200.0f;
+
+		s->p[i].position[a].f[k] = spark->position[a] + jitter;
+		s->p[i].oldposition[a].f[k] = s->p[i].position[a].f[k];
+		s->p[i].delta[a].f[k] = jitter;
+	    }
+	    for (a = 0; a < 3; a++)
+		SmokeSetColor(s, i, a, k, spark->color[a]);
+	    SmokeSetColor(s, i, 3, k, 0.85f);
+	    SmokeSetBirth(s, i, k, flurry->fTime);
+	    SmokeSetDead(s, i, k, 0);
+	    SmokeSetFrame(s, i, k, RngNext(rng) & 63);
+	}
+    }
+}
+
+/* One update and draw of a full flurry, a few times over with the
+   kernels taking turns, from the same particles each time; the best
+   time of each counts. */
+static void OptModeTime(void)
+{
+    global_info_t global;
+    flurry_info_t *flurry;
+    SmokeStaging st;
+    SmokeV *saved;
+    double best[OPT_MODE_MAX], t;
+    int probe, round, m, mode, live, pick;
+
+    for (probe = 0; probe < OPT_MODE_PROBES; probe++)
+	optModeFor[probe] = OPT_MODE_VECTOR;
+
+    memset(&global, 0, sizeof(global));
+    global.sys_glWidth = 1920.0f;
+    global.sys_glHeight = 1080.0f;
+    RngSeed(&global.rng, 1);
+    if (!(saved = malloc(sizeof(SmokeV))))
+	return;
+    if (!InitSmokeStaging(&st, NUMSMOKEPARTICLES)) {
+	free(saved);
+	return;
+    }
+
+    for (probe = 0; probe < OPT_MODE_PROBES; probe++) {
+	if (!(flurry = new_flurry_info(&global, 1 << probe, tiedyeColorMode,
+				       1000.0, 0.5, 1.0, 0.0)))
+	    break;
+	OptModeFill(flurry, &global.rng);
+	memcpy(saved, flurry->s, sizeof(SmokeV));
+
+	for (mode = 0; mode < OPT_MODE_MAX; mode++)
+	    best[mode] = -1.0;
+	for (round = 0; round < OPT_MODE_ROUNDS; round++) {
+	    for (m = 0; m < OPT_MODE_MAX; m++) {
+		mode = (m + round) % OPT_MODE_MAX;
+		if (!OptModeSupported(mode))
+		    continue;
+		memcpy(flurry->s, saved, sizeof(SmokeV));
+		global.optMode = mode;
+		live = 0;
+		t = ProfileClock();
+		UpdateSmoke(&global, flurry, flurry->s);
+		DrawSmokeRange(&global, flurry, flurry->s, &st, 1.0f,
+			       0, flurry->s->numGroups, &live);
+		t = ProfileClock() - t;
+		if (best[mode] < 0.0 || t < best[mode])
+		    best[mode] = t;
+	    }
+	}
+
+	for (pick = OPT_MODE_SCALAR_BASE, mode = pick + 1; mode < OPT_MODE_MAX; mode++)
+	    if (best[mode] >= 0.0 && best[mode] < best[pick] * OPT_MODE_MARGIN)
+		pick = mode;
+	optModeFor[probe] = pick;
+	delete_flurry_info(flurry);
+    }
+
+    FreeSmokeStaging(&st);
+    free(saved);
+}
+
+int OptModeForStreams(int streams)
+{
+    int probe = 0;
+
+    pthread_once(&optModeOnce, OptModeTime);
+    while (probe < OPT_MODE_PROBES - 1 && (2 << probe) <= streams)
+	probe++;
+    return optModeFor[probe];
+}
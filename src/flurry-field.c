@@ -0,0 +1,784 @@
+/*
+
+Copyright (c) 2002, Calum Robinson
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+* Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+/* Field.c: the sparks' pull sampled on a grid, for very many streams.
+
+   The exact update (UpdateSmoke_ScalarBase and its vector builds) pulls
+   every particle toward every spark, so a frame costs particles times
+   streams.  With global->fieldGrid set to n, the pull is split at a
+   radius H of FIELD_SPLIT cells.  The long range part, each spark's
+   1/r^2 smoothed inside H by the cubic spline softening of N-body codes,
+   is summed once per frame at n^3 nodes of a box around the sparks (the
+   whole pull, less the short range part at the few nodes within H) and
+   read back by Catmull-Rom interpolation over the 4x4x4 nodes around
+   the particle.  What the smoothing took away is added back exactly from
+   the sparks within H, found by binning the sparks and the particles on
+   a grid of side H; the particle's own spark, streamBias and all, always
+   goes that way.  A particle outside the box gets the exact sum.
+
+   So the only error is the interpolation's, across a field that varies
+   on the scale of H rather than of a close pass.  Against the exact pull,
+   over the -bench presets and 16 to 256 streams from 30 to 600 frames in,
+   the normalised RMS stayed under 5% at n = 8 and under 3.5% from n = 12,
+   with the worst 1% of particles up to a quarter out.  FieldError
+   measures it; the golden runs stay on the exact pull.
+
+   A frame costs n^3 times streams for the nodes, at about an exact
+   pair's price each, plus the close pairs and the lookups, so the grid
+   only pays with many streams and a narrow exact kernel to beat: timed
+   here, from 64 streams against the scalar update and at none up to 256
+   against the vector builds.  FieldFrom times it against the kernel the
+   flurry would otherwise take, once per grid size, and below the stream
+   count where it wins the flurry keeps its exact update.  The nodes, the
+   close pairs and the lookup weights run four lanes at a time in the
+   compiler's generic vectors, each lookup's sum a node's x, y and z at
+   a time. */
+
+#include <pthread.h>
+#include <string.h>
+
+#include <flurry.h>
+
+#if defined(__SSE__)
+#include <immintrin.h>
+#endif
+
+#define FIELD_PAD 0.1f		/* of the sparks' extent, on every side */
+#define FIELD_SPLIT 3.0f	/* H, in cells */
+#define FIELD_MIN_EXTENT 50.0f
+#define FIELD_MAX_BINS 16	/* a side */
+#define FIELD_PROBES 5		/* timed at 16, 32 ... 256 streams */
+#define FIELD_ROUNDS 3
+#define FIELD_NEVER (MAX_BENCH_SPARKS + 1)
+#define FIELD_LIVE 48		/* particles a stream keeps alive at 60Hz */
+
+typedef float FieldVec __attribute__((vector_size(16)));
+typedef int FieldMask __attribute__((vector_size(16)));
+
+typedef union
+{
+    FieldVec v;
+    float f[4];
+} FieldLanes;
+
+#define FIELD_BLEND(m, a, b) \
+    ((FieldVec) (((FieldMask) (a) & (m)) | ((FieldMask) (b) & ~(m))))
+
+typedef struct Field
+{
+    int n;
+    float lo[3], hi[3], h[3], inv[3];	/* nodes at lo + i * h */
+    float split, splitInv;		/* H */
+    int bins[3];
+    float binInv[3];			/* bins of side H or more over the box */
+    const int *sparkFirst;		/* per bin, where its sparks start */
+    const int *sparkList;		/* the sparks, bin by bin */
+    float sparkX[MAX_BENCH_SPARKS], sparkY[MAX_BENCH_SPARKS], sparkZ[MAX_BENCH_SPARKS];
+} Field;
+
+/* What a thread needs for one flurry's field, kept between frames: the
+   padded nodes (x, y, z, 0, times gravity), the bins' lists, and the live
+   particles in bin order with the pull each one ends up with. */
+typedef struct FieldScratch
+{
+    FieldVec *nodes;
+    int nodeRoom;
+    int *bins;				/* first sparks, then particles */
+    int binRoom;
+    int bin[NUMSMOKEPARTICLES];		/* of each live particle inside */
+    int live[NUMSMOKEPARTICLES];	/* their index, i * 4 + k */
+    int order[NUMSMOKEPARTICLES];	/* the same, bin by bin */
+    float pull[3][NUMSMOKEPARTICLES];	/* by particle index */
+} FieldScratch;
+
+static __thread FieldScratch *fieldScratch;
+
+/* the fewest streams from which each grid beats each mode's exact
+   update; 0 until timed */
+static pthread_mutex_t fieldLock = PTHREAD_MUTEX_INITIALIZER;
+static int fieldFrom[FIELD_MAX_GRID + 1][OPT_MODE_MAX + 1];
+
+int FieldGridValid(int n)
+{
+    return n >= 2 && n <= FIELD_MAX_GRID;
+}
+
+static inline FieldVec FieldSqrt(FieldVec v)
+{
+#if defined(__SSE__)
+    return (FieldVec) _mm_sqrt_ps((__m128) v);
+#else
+    FieldLanes r;
+    int l;
+
+    r.v = v;
+    for (l = 0; l < 4; l++)
+	r.f[l] = sqrtf(r.f[l]);
+    return r.v;
+#endif
+}
+
+/* What the long range part of 1/r^3 (Springel's spline, exact from H
+   out) leaves out, four distances at a time: 1/r^3 less the spline
+   inside H, nothing beyond it. */
+static inline FieldVec FieldShort(const Field *field, FieldVec rsquared)
+{
+    FieldVec r = FieldSqrt(rsquared);
+    FieldVec u = r * field->splitInv, zero = {0, 0, 0, 0};
+    float h3 = field->splitInv * field->splitInv * field->splitInv;
+    FieldVec inv3 = 1.0f / (rsquared * r), inner, outer;
+
+    inner = inv3 - h3 * (10.666667f + u * u * (32.0f * u - 38.4f));
+    outer = 1.066666667f * inv3 - h3 * (21.333333f + u * (-48.0f + u * (38.4f - 10.666667f * u)));
+    return FIELD_BLEND(u < 0.5f, inner, FIELD_BLEND(u < 1.0f, outer, zero));
+}
+
+/* where node (x, y, z) is kept, inside a layer of padding */
+static inline int FieldNode(int n, int x, int y, int z)
+{
+    return ((z + 1) * (n + 2) + y + 1) * (n + 2) + x + 1;
+}
+
+static int FieldBin(const Field *field, const float p[3])
+{
+    int a, c[3];
+
+    for (a = 0; a < 3; a++)
+	c[a] = MAX_(0, MIN_(field->bins[a] - 1, (int) ((p[a] - field->lo[a]) * field->binInv[a])));
+    return (c[2] * field->bins[1] + c[1]) * field->bins[0] + c[0];
+}
+
+static FieldScratch *FieldGetScratch(int nodes, int bins)
+{
+    FieldScratch *scratch = fieldScratch;
+    void *p;
+
+    if (!scratch && !(scratch = fieldScratch = calloc(1, sizeof(FieldScratch))))
+	return NULL;
+    if (nodes > scratch->nodeRoom) {
+	if (!(p = realloc(scratch->nodes, nodes * sizeof(FieldVec))))
+	    return NULL;
+	scratch->nodes = p;
+	scratch->nodeRoom = nodes;
+    }
+    if (bins > scratch->binRoom) {
+	if (!(p = realloc(scratch->bins, bins * sizeof(int))))
+	    return NULL;
+	scratch->bins = p;
+	scratch->binRoom = bins;
+    }
+    return scratch;
+}
+
+/* Counting sort of count items into bins: first[] gets numBins + 1
+   starts and list[] the items bin by bin. */
+static void FieldSort(int *first, int *list, const int *bin, const int *item, int count, int numBins)
+{
+    int b, j;
+
+    memset(first, 0, (numBins + 1) * sizeof(int));
+    for (j = 0; j < count; j++)
+	first[bin[j] + 1]++;
+    for (b = 0; b < numBins; b++)
+	first[b + 1] += first[b];
+    /* first[b] is the cursor, which leaves it where bin b ends ... */
+    for (j = 0; j < count; j++)
+	list[first[bin[j]]++] = item[j];
+    /* ... so shift it back by one */
+    memmove(first + 1, first, numBins * sizeof(int));
+    first[0] = 0;
+}
+
+static int FieldBuild(Field *field, flurry_info_t *flurry, int n, FieldScratch **out)
+{
+    int numStreams = flurry->numStreams, total = n * n * n, m = n + 2;
+    int bin[MAX_BENCH_SPARKS], item[MAX_BENCH_SPARKS];
+    float lo[3], hi[3], extent;
+    FieldScratch *scratch;
+    int *sparkFirst;
+    int a, i, j, l, numBins;
+
+    if (!FieldGridValid(n) || numStreams < 1 || numStreams > MAX_BENCH_SPARKS)
+	return 0;
+
+    for (a = 0; a < 3; a++)
+	lo[a] = hi[a] = flurry->spark[0].position[a];
+    for (j = 0; j < numStreams; j++) {
+	field->sparkX[j] = flurry->spark[j].position[0];
+	field->sparkY[j] = flurry->spark[j].position[1];
+	field->sparkZ[j] = flurry->spark[j].position[2];
+	for (a = 0; a < 3; a++) {
+	    lo[a] = MIN_(lo[a], flurry->spark[j].position[a]);
+	    hi[a] = MAX_(hi[a], flurry->spark[j].position[a]);
+	}
+    }
+    /* FieldExact reads them four at a time */
+    for (; j % 4; j++)
+	field->sparkX[j] = field->sparkY[j] = field->sparkZ[j] = 0.0f;
+
+    extent = MAX_(FIELD_MIN_EXTENT, MAX_(hi[0] - lo[0], MAX_(hi[1] - lo[1], hi[2] - lo[2])));
+    field->split = 0.0f;
+    for (a = 0; a < 3; a++) {
+	field->lo[a] = lo[a] - FIELD_PAD * extent;
+	field->hi[a] = hi[a] + FIELD_PAD * extent;
+	field->h[a] = (field->hi[a] - field->lo[a]) / (n - 1);
+	field->inv[a] = 1.0f / field->h[a];
+	field->split = MAX_(field->split, FIELD_SPLIT * field->h[a]);
+    }
+    field->splitInv = 1.0f / field->split;
+    field->n = n;
+
+    numBins = 1;
+    for (a = 0; a < 3; a++) {
+	float side = field->hi[a] - field->lo[a];
+
+	field->bins[a] = MAX_(1, MIN_(FIELD_MAX_BINS, (int) (side * field->splitInv)));
+	field->binInv[a] = field->bins[a] / side;
+	numBins *= field->bins[a];
+    }
+    if (!(scratch = FieldGetScratch(m * m * m, 2 * (numBins + 1) + numStreams)))
+	return 0;
+
+    sparkFirst = scratch->bins;
+    for (j = 0; j < numStreams; j++) {
+	bin[j] = FieldBin(field, flurry->spark[j].position);
+	item[j] = j;
+    }
+    FieldSort(sparkFirst, sparkFirst + numBins + 1, bin, item, numStreams, numBins);
+    field->sparkFirst = sparkFirst;
+    field->sparkList = sparkFirst + numBins + 1;
+
+    /* the nodes four at a time, in storage order: all of every spark's
+       pull ... */
+    for (i = 0; i < total; i += 4) {
+	FieldVec px, py, pz, gx = {0, 0, 0, 0}, gy = gx, gz = gx;
+	FieldLanes x, y, z;
+
+	for (l = 0; l < 4; l++) {
+	    int node = MIN_(i + l, total - 1);
+
+	    x.f[l] = field->lo[0] + (node % n) * field->h[0];
+	    y.f[l] = field->lo[1] + (node / n % n) * field->h[1];
+	    z.f[l] = field->lo[2] + (node / (n * n)) * field->h[2];
+	}
+	px = x.v;
+	py = y.v;
+	pz = z.v;
+
+	for (j = 0; j < numStreams; j++) {
+	    FieldVec dx = px - field->sparkX[j];
+	    FieldVec dy = py - field->sparkY[j];
+	    FieldVec dz = pz - field->sparkZ[j];
+	    FieldVec rsquared = dx*dx+dy*dy+dz*dz;
+	    FieldVec mag = 1.0f / (rsquared * FieldSqrt(rsquared));
+
+	    gx += dx * mag;
+	    gy += dy * mag;
+	    gz += dz * mag;
+	}
+	x.v = gx * gravity;
+	y.v = gy * gravity;
+	z.v = gz * gravity;
+	for (l = 0; l < 4 && i + l < total; l++) {
+	    int node = i + l;
+
+	    scratch->nodes[FieldNode(n, node % n, node / n % n, node / (n * n))] =
+		(FieldVec) {x.f[l], y.f[l], z.f[l], 0.0f};
+	}
+    }
+
+    /* ... less the short range part at the few nodes within H of it */
+    for (j = 0; j < numStreams; j++) {
+	int from[3], to[3], y, z;
+
+	for (a = 0; a < 3; a++) {
+	    float t = (flurry->spark[j].position[a] - field->lo[a]) * field->inv[a];
+	    float reach = field->split * field->inv[a];
+
+	    from[a] = MAX_(0, (int) ceilf(t - reach));
+	    to[a] = MIN_(n - 1, (int) (t + reach));
+	}
+	for (z = from[2]; z <= to[2]; z++)
+	    for (y = from[1]; y <= to[1]; y++)
+		for (i = from[0]; i <= to[0]; i += 4) {
+		    FieldVec dx, dy, dz, mag;
+		    FieldLanes x;
+
+		    for (l = 0; l < 4; l++)
+			x.f[l] = field->lo[0] + (i + l) * field->h[0];
+		    dx = x.v - field->sparkX[j];
+		    dy = (FieldVec) {0, 0, 0, 0} + (field->lo[1] + y * field->h[1] - field->sparkY[j]);
+		    dz = (FieldVec) {0, 0, 0, 0} + (field->lo[2] + z * field->h[2] - field->sparkZ[j]);
+		    x.v = FieldShort(field, dx*dx+dy*dy+dz*dz) * gravity;
+		    for (l = 0; l < 4 && i + l <= to[0]; l++) {
+			FieldVec *node = &scratch->nodes[FieldNode(n, i + l, y, z)];
+
+			*node -= (FieldVec) {dx[l], dy[l], dz[l], 0.0f} * x.f[l];
+		    }
+		}
+    }
+
+    /* and a layer around them that repeats the edge's, for the lookups
+       at the edge of the box */
+    for (i = 0; i < m * m * m; i++) {
+	int x = i % m, y = i / m % m, z = i / (m * m);
+
+	if (x % (n + 1) && y % (n + 1) && z % (n + 1))
+	    continue;
+	scratch->nodes[i] = scratch->nodes[FieldNode(n, MAX_(0, MIN_(n - 1, x - 1)),
+						     MAX_(0, MIN_(n - 1, y - 1)),
+						     MAX_(0, MIN_(n - 1, z - 1)))];
+    }
+    *out = scratch;
+    return 1;
+}
+
+/* The long range pull at four points inside the box: their weights
+   four points at a time, then each point's 4x4x4 nodes, a node's x, y
+   and z at a time. */
+static void FieldLookup(const Field *field, const FieldVec *nodes, const FieldVec p[3],
+			FieldVec out[4])
+{
+    FieldLanes w[3][4];
+    int at[3][4], a, l, y, z, n = field->n, m = n + 2;
+
+    for (a = 0; a < 3; a++) {
+	FieldLanes c;
+	FieldVec t = (p[a] - field->lo[a]) * field->inv[a];
+
+	for (l = 0; l < 4; l++) {
+	    at[a][l] = MAX_(0, MIN_(n - 2, (int) t[l]));
+	    c.f[l] = at[a][l];
+	}
+	t -= c.v;
+	w[a][0].v = 0.5f * t * (t * (2.0f - t) - 1.0f);
+	w[a][1].v = 0.5f * (t * t * (3.0f * t - 5.0f) + 2.0f);
+	w[a][2].v = 0.5f * t * (t * (4.0f - 3.0f * t) + 1.0f);
+	w[a][3].v = 0.5f * t * t * (t - 1.0f);
+    }
+
+    for (l = 0; l < 4; l++) {
+	/* the padded node before the cell's, so the 4x4x4 are all there */
+	const FieldVec *g = &nodes[(at[2][l] * m + at[1][l]) * m + at[0][l]];
+	FieldVec sum = {0, 0, 0, 0};
+
+	for (z = 0; z < 4; z++, g += m * (m - 4)) {
+	    FieldVec plane = {0, 0, 0, 0};
+
+	    for (y = 0; y < 4; y++, g += m) {
+		FieldVec row = g[0] * w[0][0].f[l] + g[1] * w[0][1].f[l] +
+			       g[2] * w[0][2].f[l] + g[3] * w[0][3].f[l];
+
+		plane += row * w[1][y].f[l];
+	    }
+	    sum += plane * w[2][z].f[l];
+	}
+	out[l] = sum;
+    }
+}
+
+/* the exact pull on the particle at p, for outside the box */
+static void FieldExact(const Field *field, const flurry_info_t *flurry, const float p[3],
+		       int own, float out[3])
+{
+    const float *o = flurry->spark[own].position;
+    FieldVec gx = {0, 0, 0, 0}, gy = gx, gz = gx, zero = gx;
+    float dx, dy, dz, rsquared, bias;
+    int j;
+
+    /* four sparks at a time; the lanes past the last are masked off */
+    for (j = 0; j < flurry->numStreams; j += 4) {
+	FieldMask in = (FieldMask) {j, j + 1, j + 2, j + 3} < flurry->numStreams;
+	FieldVec x, y, z, r2, mag;
+
+	memcpy(&x, &field->sparkX[j], sizeof(x));
+	memcpy(&y, &field->sparkY[j], sizeof(y));
+	memcpy(&z, &field->sparkZ[j], sizeof(z));
+	x = p[0] - x;
+	y = p[1] - y;
+	z = p[2] - z;
+	r2 = x*x+y*y+z*z;
+	mag = FIELD_BLEND(in, 1.0f / (r2 * FieldSqrt(r2)), zero);
+	gx += x * mag;
+	gy += y * mag;
+	gz += z * mag;
+    }
+    dx = p[0] - o[0];
+    dy = p[1] - o[1];
+    dz = p[2] - o[2];
+    rsquared = dx*dx+dy*dy+dz*dz;
+    bias = streamBias / (rsquared * sqrtf(rsquared));
+    out[0] = gravity * (gx[0] + gx[1] + gx[2] + gx[3] + dx * bias);
+    out[1] = gravity * (gy[0] + gy[1] + gy[2] + gy[3] + dy * bias);
+    out[2] = gravity * (gz[0] + gz[1] + gz[2] + gz[3] + dz * bias);
+}
+
+/* The pull on every live particle, before frameRateModifier, into
+   scratch->pull.  The particles are binned so that four at a time go
+   through the sparks of the bins around them. */
+static void FieldPull(const Field *field, const flurry_info_t *flurry, const SmokeV *s,
+		      FieldScratch *scratch)
+{
+    int numStreams = flurry->numStreams;
+    int numBins = field->bins[0] * field->bins[1] * field->bins[2];
+    int *first = scratch->bins + numBins + 1 + numStreams;
+    int count = 0, b, c, i, k, l, a;
+
+    for (i = 0; i < s->numGroups; i++) {
+	for (k = 0; k < 4; k++) {
+	    float p[3], pull[3];
+
+	    if (SmokeDead(s, i, k))
+		continue;
+	    for (a = 0; a < 3; a++)
+		p[a] = s->p[i].position[a].f[k];
+	    for (a = 0; a < 3; a++)
+		if (p[a] < field->lo[a] || p[a] > field->hi[a])
+		    break;
+	    if (a < 3) {
+		FieldExact(field, flurry, p, (i*4+k) % numStreams, pull);
+		for (a = 0; a < 3; a++)
+		    scratch->pull[a][i*4+k] = pull[a];
+		continue;
+	    }
+	    scratch->bin[count] = FieldBin(field, p);
+	    scratch->live[count++] = i*4+k;
+	}
+    }
+    FieldSort(first, scratch->order, scratch->bin, scratch->live, count, numBins);
+
+    for (b = 0; b < numBins; b++) {
+	int bx = b % field->bins[0], by = b / field->bins[0] % field->bins[1];
+	int bz = b / (field->bins[0] * field->bins[1]);
+
+	for (c = first[b]; c < first[b + 1]; c += 4) {
+	    FieldLanes px, py, pz, ox, oy, oz, gx, gy, gz;
+	    FieldMask own;
+	    FieldVec dx, dy, dz, rsquared, mag, zero = {0, 0, 0, 0}, p[3], grid[4];
+	    int x, y, z, j, index[4];
+
+	    for (l = 0; l < 4; l++) {
+		const Spark *spark;
+
+		/* a short last vector repeats its last particle */
+		index[l] = scratch->order[MIN_(c + l, first[b + 1] - 1)];
+		px.f[l] = s->p[index[l] >> 2].position[0].f[index[l] & 3];
+		py.f[l] = s->p[index[l] >> 2].position[1].f[index[l] & 3];
+		pz.f[l] = s->p[index[l] >> 2].position[2].f[index[l] & 3];
+		own[l] = index[l] % numStreams;
+		spark = &flurry->spark[own[l]];
+		ox.f[l] = spark->position[0];
+		oy.f[l] = spark->position[1];
+		oz.f[l] = spark->position[2];
+	    }
+
+	    /* the own sparks' exact, biased pull, less what the grid has */
+	    dx = px.v - ox.v;
+	    dy = py.v - oy.v;
+	    dz = pz.v - oz.v;
+	    rsquared = dx*dx+dy*dy+dz*dz;
+	    mag = streamBias / (rsquared * FieldSqrt(rsquared)) + FieldShort(field, rsquared);
+	    gx.v = dx * mag;
+	    gy.v = dy * mag;
+	    gz.v = dz * mag;
+
+	    /* and the same, unbiased, for the other sparks within H */
+	    for (z = MAX_(0, bz - 1); z <= MIN_(field->bins[2] - 1, bz + 1); z++)
+		for (y = MAX_(0, by - 1); y <= MIN_(field->bins[1] - 1, by + 1); y++)
+		    for (x = MAX_(0, bx - 1); x <= MIN_(field->bins[0] - 1, bx + 1); x++) {
+			int nb = (z * field->bins[1] + y) * field->bins[0] + x;
+
+			for (i = field->sparkFirst[nb]; i < field->sparkFirst[nb + 1]; i++) {
+			    FieldMask near;
+
+			    j = field->sparkList[i];
+			    dx = px.v - field->sparkX[j];
+			    dy = py.v - field->sparkY[j];
+			    dz = pz.v - field->sparkZ[j];
+			    rsquared = dx*dx+dy*dy+dz*dz;
+			    near = (rsquared < field->split * field->split) & (own != j);
+			    if (!(near[0] | near[1] | near[2] | near[3]))
+				continue;
+			    mag = FIELD_BLEND(near, FieldShort(field, rsquared), zero);
+			    gx.v += dx * mag;
+			    gy.v += dy * mag;
+			    gz.v += dz * mag;
+			}
+		    }
+
+	    p[0] = px.v;
+	    p[1] = py.v;
+	    p[2] = pz.v;
+	    FieldLookup(field, scratch->nodes, p, grid);
+	    for (l = 0; l < 4 && c + l < first[b + 1]; l++) {
+		scratch->pull[0][index[l]] = grid[l][0] + gx.f[l] * gravity;
+		scratch->pull[1][index[l]] = grid[l][1] + gy.f[l] * gravity;
+		scratch->pull[2][index[l]] = grid[l][2] + gz.f[l] * gravity;
+	    }
+	}
+    }
+}
+
+/* UpdateSmoke on the field, whether or not it pays */
+static int FieldUpdate(global_info_t *global, flurry_info_t *flurry, SmokeV *s)
+{
+    FieldScratch *scratch;
+    Field field;
+    float frameRateModifier, dt = flurry->fDeltaTime, drag = flurry->drag;
+    int i, k, a;
+
+    if (!FieldBuild(&field, flurry, global->fieldGrid, &scratch))
+	return 0;
+
+    EmitSmoke(flurry, s);
+    FieldPull(&field, flurry, s, scratch);
+
+    frameRateModifier = 42.5f / (((double) flurry->dframe)/(flurry->fTime));
+
+    for (i = 0; i < s->numGroups; i++) {
+	SmokeParticleV *p = &s->p[i];
+	FieldLanes v[3], speed;
+
+	for (k = 0; k < 4 && SmokeDead(s, i, k); k++)
+	    ;
+	if (k == 4)
+	    continue;
+
+	for (a = 0; a < 3; a++) {
+	    FieldVec pull;
+
+	    memcpy(&v[a].v, p->delta[a].f, sizeof(v[a].v));
+	    memcpy(&pull, &scratch->pull[a][i * 4], sizeof(pull));
+	    v[a].v = (v[a].v - pull * frameRateModifier) * drag;
+	}
+	speed.v = v[0].v * v[0].v + v[1].v * v[1].v + v[2].v * v[2].v;
+
+	for (k = 0; k < 4; k++) {
+	    if (SmokeDead(s, i, k))
+		continue;
+	    if (speed.f[k] >= 25000000.0f) {
+		SmokeSetDead(s, i, k, 1);
+		continue;
+	    }
+	    for (a = 0; a < 3; a++) {
+		p->delta[a].f[k] = v[a].f[k];
+		p->oldposition[a].f[k] = p->position[a].f[k];
+		p->position[a].f[k] += v[a].f[k] * dt;
+	    }
+	}
+    }
+    return 1;
+}
+
+/* Sparks a few seconds along their paths and as many particles as
+   they would have spread around their own spark, much as a running
+   flurry's are. */
+static void FieldFill(global_info_t *global, flurry_info_t *flurry)
+{
+    SmokeV *s = flurry->s;
+    int live = flurry->numStreams * FIELD_LIVE;
+    int i, k, a;
+
+    flurry->fTime += 3.0;
+    flurry->fDeltaTime = 1.0 / 60.0;
+    flurry->dframe = 180;
+    UpdateSparks(global, flurry, flurry->numStreams);
+
+    for (i = 0; i < s->numGroups; i++) {
+	for (k = 0; k < 4; k++) {
+	    const Spark *spark = &flurry->spark[(i * 4 + k) % flurry->numStreams];
+
+	    for (a = 0; a < 3; a++) {
+		float jitter = (float) (RngNext(&global->rng) % 4000) - 2000.0f;
+
+		s->p[i].position[a].f[k] = spark->position[a] + jitter;
+		s->p[i].oldposition[a].f[k] = s->p[i].position[a].f[k];
+		s->p[i].delta[a].f[k] = jitter * 0.01f;
+	    }
+	    SmokeSetBirth(s, i, k, flurry->fTime);
+	    SmokeSetDead(s, i, k, i * 4 + k >= live);
+	}
+    }
+}
+
+/* The n^3 field against optMode's exact update on full flurries of 16
+   to MAX_BENCH_SPARKS streams, from the same particles each time, the
+   best of a few rounds each; the field is taken from the fewest streams
+   from which it won every larger count.  The emitters draw on the
+   flurry's own generator, not the caller's. */
+static int FieldTime(int n, int optMode)
+{
+    global_info_t global;
+    flurry_info_t *flurry;
+    FlurryRng *home;
+    SmokeV *saved;
+    double best[2], t;
+    int probe, round, field, from = FIELD_NEVER;
+
+    memset(&global, 0, sizeof(global));
+    RngSeed(&global.rng, 1);
+    if (!(saved = malloc(sizeof(SmokeV))))
+	return FIELD_NEVER;
+
+    for (probe = 0; probe < FIELD_PROBES; probe++) {
+	int streams = 16 << probe;
+
+	if (!(flurry = new_flurry_info(&global, streams, tiedyeColorMode,
+				       1000.0, 0.5, 1.0, 0.0)))
+	    break;
+	FieldFill(&global, flurry);
+	memcpy(saved, flurry->s, sizeof(SmokeV));
+	home = RngBind(&flurry->rng);
+
+	best[0] = best[1] = -1.0;
+	for (round = 0; round < FIELD_ROUNDS; round++) {
+	    for (field = 0; field < 2; field++) {
+		memcpy(flurry->s, saved, sizeof(SmokeV));
+		global.optMode = optMode;
+		global.fieldGrid = field ? n : 0;
+		t = ProfileClock();
+		if (field)
+		    FieldUpdate(&global, flurry, flurry->s);
+		else
+		    UpdateSmoke(&global, flurry, flurry->s);
+		t = ProfileClock() - t;
+		if (best[field] < 0.0 || t < best[field])
+		    best[field] = t;
+	    }
+	}
+	RngBind(home);
+	delete_flurry_info(flurry);
+
+	if (best[1] < best[0])
+	    from = MIN_(from, streams);
+	else
+	    from = FIELD_NEVER;
+    }
+    free(saved);
+    return from;
+}
+
+int FieldFrom(int n, int optMode)
+{
+    int from;
+
+    /* every node costs more than a particle does in the exact update */
+    if (!FieldGridValid(n) || n * n * n >= NUMSMOKEPARTICLES)
+	return FIELD_NEVER;
+
+    pthread_mutex_lock(&fieldLock);
+    if (!(from = fieldFrom[n][optMode]))
+	from = fieldFrom[n][optMode] = FieldTime(n, optMode);
+    pthread_mutex_unlock(&fieldLock);
+    return from;
+}
+
+int FieldPays(const global_info_t *global, const flurry_info_t *flurry)
+{
+    return global->fieldGrid > 0 &&
+	   flurry->numStreams >= FieldFrom(global->fieldGrid, global->optMode);
+}
+
+int UpdateSmoke_Field(global_info_t *global, flurry_info_t *flurry, SmokeV *s)
+{
+    return FieldPays(global, flurry) && FieldUpdate(global, flurry, s);
+}
+
+static int compareFloat(const void *a, const void *b)
+{
+    float x = *(const float *) a;
+    float y = *(const float *) b;
+
+    return (x > y) - (x < y);
+}
+
+/* How far the n^3 grid's pull on the live particles is from the exact
+   sum: the root mean square and the 99th percentile of |grid - exact| /
+   |exact|.  Returns how many particles that was over. */
+int FieldError(flurry_info_t *flurry, int n, double *rms, float *p99)
+{
+    static __thread float err[NUMSMOKEPARTICLES];
+    FieldScratch *scratch;
+    SmokeV *s = flurry->s;
+    Field field;
+    double sum = 0.0, norm = 0.0;
+    int i, j, k, count = 0;
+
+    *rms = 0.0;
+    *p99 = 0.0f;
+    if (!FieldBuild(&field, flurry, n, &scratch))
+	return 0;
+    FieldPull(&field, flurry, s, scratch);
+
+    for (i = 0; i < s->numGroups; i++) {
+	for (k = 0; k < 4; k++) {
+	    double exact[3], e2 = 0.0, x2 = 0.0;
+	    int a;
+
+	    if (SmokeDead(s, i, k))
+		continue;
+
+	    for (a = 0; a < 3; a++)
+		exact[a] = 0.0;
+	    for (j = 0; j < flurry->numStreams; j++) {
+		double dx = s->p[i].position[0].f[k] - flurry->spark[j].position[0];
+		double dy = s->p[i].position[1].f[k] - flurry->spark[j].position[1];
+		double dz = s->p[i].position[2].f[k] - flurry->spark[j].position[2];
+		double rsquared = dx*dx+dy*dy+dz*dz;
+		double mag = gravity / (rsquared * sqrt(rsquared));
+
+		if ((i*4+k) % flurry->numStreams == j)
+		    mag *= 1.0 + streamBias;
+		exact[0] += dx * mag;
+		exact[1] += dy * mag;
+		exact[2] += dz * mag;
+	    }
+	    for (a = 0; a < 3; a++) {
+		double d = scratch->pull[a][i*4+k] - exact[a];
+
+		e2 += d * d;
+		x2 += exact[a] * exact[a];
+	    }
+	    if (x2 <= 0.0)
+		continue;
+	    err[count++] = (float) sqrt(e2 / x2);
+	    sum += e2;
+	    norm += x2;
+	}
+    }
+    if (!count)
+	return 0;
+
+    qsort(err, count, sizeof(float), compareFloat);
+    *rms = sqrt(sum / norm);
+    *p99 = err[(count - 1) * 99 / 100];
+    return count;
+}
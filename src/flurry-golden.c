@@ -0,0 +1,591 @@
+/*
+
+Copyright (c) 2002, Calum Robinson
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+* Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/* Golden.c: headless regression harness for the smoke and spark kernels.
+
+   A preset is run from a fixed seed with a fixed time step, once through
+   the scalar reference kernels and once through the kernel under test.
+   After every frame the particle state, the sparks and the generated
+   vertex stream are compared and the first difference outside the
+   tolerance is reported.  The reference can also be dumped to a file and
+   checked later, so builds with different compiler flags can be compared
+   against each other. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <flurry.h>
+
+#define GOLDEN_MAGIC   0x44474c46 /* "FLGD" */
+#define GOLDEN_VERSION 1
+#define GOLDEN_WIDTH   1024.0f
+#define GOLDEN_HEIGHT  768.0f
+
+typedef struct GoldenOptions
+{
+    int preset;
+    int all;
+    int frames;
+    unsigned int seed;
+    double dt;
+    int optMode;
+    unsigned int maxUlp;
+    float rtol;
+    int resync;
+    float lodWidth;
+    float substepRate;
+    int fused;
+    const char *dump;
+    const char *check;
+} GoldenOptions;
+
+typedef struct GoldenParticle
+{
+    int index;
+    int animFrame;
+    float time;
+    float position[3];
+    float oldposition[3];
+    float delta[3];
+    float color[4];
+} GoldenParticle;
+
+typedef struct GoldenQuad
+{
+    float vertex[8];
+    float color[16];
+    float texture[8];
+} GoldenQuad;
+
+/* everything observable about one flurry after one frame */
+typedef struct GoldenFlurry
+{
+    int numStreams;
+    int numLive;
+    int quads;
+    GoldenParticle p[NUMSMOKEPARTICLES];
+    float spark[MAX_SPARKS][6];	/* position, rgb; alpha is unused */
+    GoldenQuad q[NUMSMOKEPARTICLES];
+} GoldenFlurry;
+
+typedef struct GoldenHeader
+{
+    int magic;
+    int version;
+    int preset;
+    int frames;
+    unsigned int seed;
+    int numFlurries;
+    double dt;
+} GoldenHeader;
+
+typedef struct GoldenScene
+{
+    global_info_t global;
+    int numFlurries;
+    GoldenFlurry *capture;
+} GoldenScene;
+
+static unsigned int worstUlp;	/* over the preset being checked */
+
+static void GoldenDestroy(GoldenScene *scene)
+{
+    flurry_info_t *flurry;
+
+    while ((flurry = scene->global.flurry)) {
+	scene->global.flurry = flurry->next;
+	delete_flurry_info(flurry);
+    }
+    free(scene->capture);
+    if (scene->global.staging)
+	FreeSmokeStaging(scene->global.staging);
+    free(scene->global.staging);
+}
+
+static int GoldenCreate(GoldenScene *scene, const GoldenOptions *opts, int preset, int optMode)
+{
+    flurry_info_t *flurry;
+
+    memset(scene, 0, sizeof(GoldenScene));
+    scene->global.optMode = optMode;
+    scene->global.sys_glWidth = GOLDEN_WIDTH;
+    scene->global.sys_glHeight = GOLDEN_HEIGHT;
+    scene->global.lodWidth = opts->lodWidth;
+    scene->global.substepRate = opts->substepRate;
+
+    RngSeed(&scene->global.rng, opts->seed);
+    if (!CreatePreset(&scene->global, preset, 0.0))
+	return 0;
+
+    for (flurry = scene->global.flurry; flurry; flurry = flurry->next)
+	scene->numFlurries++;
+
+    scene->capture = calloc(scene->numFlurries, sizeof(GoldenFlurry));
+    scene->global.staging = calloc(1, sizeof(SmokeStaging));
+    if (!scene->capture || !scene->global.staging ||
+	!InitSmokeStaging(scene->global.staging, NUMSMOKEPARTICLES)) {
+	GoldenDestroy(scene);
+	return 0;
+    }
+    return 1;
+}
+
+static void Capture(flurry_info_t *flurry, SmokeStaging *st, int quads, GoldenFlurry *g)
+{
+    SmokeV *s = flurry->s;
+    int i, k, j;
+
+    g->numStreams = flurry->numStreams;
+    g->numLive = 0;
+    for (i = 0; i < NUMSMOKEPARTICLES/4; i++) {
+	for (k = 0; k < 4; k++) {
+	    GoldenParticle *p = &g->p[g->numLive];
+
+	    if (SmokeDead(s, i, k))
+		continue;
+
+	    p->index = i * 4 + k;
+	    p->animFrame = SmokeFrame(s, i, k);
+	    p->time = SmokeBirth(s, i, k);
+	    for (j = 0; j < 3; j++) {
+		p->position[j] = s->p[i].position[j].f[k];
+		p->oldposition[j] = s->p[i].oldposition[j].f[k];
+		p->delta[j] = s->p[i].delta[j].f[k];
+	    }
+	    for (j = 0; j < 4; j++)
+		p->color[j] = SmokeColor(s, i, j, k);
+	    g->numLive++;
+	}
+    }
+
+    for (i = 0; i < flurry->numStreams; i++) {
+	for (j = 0; j < 3; j++)
+	    g->spark[i][j] = flurry->spark[i].position[j];
+	for (j = 0; j < 3; j++)
+	    g->spark[i][3 + j] = flurry->spark[i].color[j];
+    }
+
+    g->quads = quads;
+    for (i = 0; i < quads; i++) {
+	memcpy(g->q[i].vertex, &st->seraphimVertices[i * 2], sizeof(g->q[i].vertex));
+	memcpy(g->q[i].color, &st->seraphimColors[i * 4], sizeof(g->q[i].color));
+	memcpy(g->q[i].texture, &st->seraphimTextures[i * 8], sizeof(g->q[i].texture));
+    }
+}
+
+static void GoldenStep(GoldenScene *scene, double now, double dt)
+{
+    flurry_info_t *flurry;
+    double brite = pow(dt, 0.75) * 10;
+    int n, quads;
+
+    for (flurry = scene->global.flurry, n = 0; flurry; flurry = flurry->next, n++) {
+	if (scene->global.fusedSmoke) {
+	    quads = StepDrawFlurry(&scene->global, flurry, now, scene->global.staging,
+				   brite * flurry->briteFactor);
+	} else {
+	    StepFlurry(&scene->global, flurry, now);
+	    quads = DrawSmoke(&scene->global, flurry, flurry->s, scene->global.staging,
+			      brite * flurry->briteFactor);
+	}
+	Capture(flurry, scene->global.staging, quads, &scene->capture[n]);
+    }
+}
+
+/* make dst continue from exactly where src is */
+static void GoldenResync(GoldenScene *dst, GoldenScene *src)
+{
+    flurry_info_t *d, *s;
+
+    dst->global.rng = src->global.rng;
+    for (d = dst->global.flurry, s = src->global.flurry; d && s; d = d->next, s = s->next) {
+	memcpy(d->s, s->s, sizeof(SmokeV));
+	memcpy(d->star, s->star, sizeof(Star));
+	memcpy(d->spark, s->spark, s->numStreams * sizeof(Spark));
+	d->flurryRandomSeed = s->flurryRandomSeed;
+	d->fTime = s->fTime;
+	d->fOldTime = s->fOldTime;
+	d->fDeltaTime = s->fDeltaTime;
+	d->drag = s->drag;
+	d->dframe = s->dframe;
+	d->rng = s->rng;
+    }
+}
+
+static unsigned int UlpDistance(float a, float b)
+{
+    union { float f; int i; } x, y;
+
+    x.f = a;
+    y.f = b;
+    /* map to a monotonic integer line so -0 and +0 are neighbours */
+    if (x.i < 0)
+	x.i = (int) (0x80000000u - (unsigned int) x.i);
+    if (y.i < 0)
+	y.i = (int) (0x80000000u - (unsigned int) y.i);
+    return x.i > y.i ? (unsigned int) x.i - (unsigned int) y.i
+		     : (unsigned int) y.i - (unsigned int) x.i;
+}
+
+static int Agrees(const GoldenOptions *opts, float ref, float cand)
+{
+    unsigned int ulp;
+
+    if (ref == cand)
+	return 1;
+    if (ref != ref || cand != cand)
+	return 0;
+
+    ulp = UlpDistance(ref, cand);
+    if (ulp <= opts->maxUlp ||
+	    fabs(ref - cand) <= opts->rtol * MAX_(fabs(ref), fabs(cand))) {
+	if (ulp > worstUlp)
+	    worstUlp = ulp;
+	return 1;
+    }
+    return 0;
+}
+
+static int CompareFloats(const GoldenOptions *opts, int frame, int flurry,
+			 const char *what, int index, const char *field,
+			 const float *ref, const float *cand, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+	if (!Agrees(opts, ref[i], cand[i])) {
+	    printf("golden: diverged at frame %d, flurry %d, %s %d: "
+		   "%s[%d] ref %.9g cand %.9g (%u ulp)\n",
+		   frame, flurry, what, index, field, i,
+		   ref[i], cand[i], UlpDistance(ref[i], cand[i]));
+	    return 0;
+	}
+    }
+    return 1;
+}
+
+static int CompareFlurry(const GoldenOptions *opts, int frame, int n,
+			 const GoldenFlurry *ref, const GoldenFlurry *cand)
+{
+    int i;
+
+    for (i = 0; i < ref->numLive && i < cand->numLive; i++) {
+	const GoldenParticle *r = &ref->p[i];
+	const GoldenParticle *c = &cand->p[i];
+
+	if (r->index != c->index) {
+	    printf("golden: diverged at frame %d, flurry %d: particle %d is %s\n",
+		   frame, n, MIN_(r->index, c->index),
+		   r->index < c->index ? "dead in candidate" : "alive in candidate");
+	    return 0;
+	}
+	if (r->animFrame != c->animFrame) {
+	    printf("golden: diverged at frame %d, flurry %d, particle %d: "
+		   "animFrame ref %d cand %d\n", frame, n, r->index,
+		   r->animFrame, c->animFrame);
+	    return 0;
+	}
+	if (!CompareFloats(opts, frame, n, "particle", r->index, "time", &r->time, &c->time, 1) ||
+		!CompareFloats(opts, frame, n, "particle", r->index, "position", r->position, c->position, 3) ||
+		!CompareFloats(opts, frame, n, "particle", r->index, "oldposition", r->oldposition, c->oldposition, 3) ||
+		!CompareFloats(opts, frame, n, "particle", r->index, "delta", r->delta, c->delta, 3) ||
+		!CompareFloats(opts, frame, n, "particle", r->index, "color", r->color, c->color, 4))
+	    return 0;
+    }
+    if (ref->numLive != cand->numLive) {
+	printf("golden: diverged at frame %d, flurry %d: %d live particles, "
+	       "candidate has %d\n", frame, n, ref->numLive, cand->numLive);
+	return 0;
+    }
+
+    for (i = 0; i < ref->numStreams; i++) {
+	if (!CompareFloats(opts, frame, n, "spark", i, "position", ref->spark[i], cand->spark[i], 3) ||
+		!CompareFloats(opts, frame, n, "spark", i, "color", ref->spark[i] + 3, cand->spark[i] + 3, 3))
+	    return 0;
+    }
+
+    for (i = 0; i < ref->quads && i < cand->quads; i++) {
+	if (!CompareFloats(opts, frame, n, "quad", i, "vertex", ref->q[i].vertex, cand->q[i].vertex, 8) ||
+		!CompareFloats(opts, frame, n, "quad", i, "color", ref->q[i].color, cand->q[i].color, 16) ||
+		!CompareFloats(opts, frame, n, "quad", i, "texture", ref->q[i].texture, cand->q[i].texture, 8))
+	    return 0;
+    }
+    if (ref->quads != cand->quads) {
+	printf("golden: diverged at frame %d, flurry %d: %d quads, "
+	       "candidate has %d\n", frame, n, ref->quads, cand->quads);
+	return 0;
+    }
+    return 1;
+}
+
+static int WriteFlurry(FILE *f, const GoldenFlurry *g)
+{
+    return fwrite(&g->numStreams, sizeof(int), 3, f) == 3 &&
+	fwrite(g->p, sizeof(GoldenParticle), g->numLive, f) == (size_t) g->numLive &&
+	fwrite(g->spark, sizeof(g->spark[0]), g->numStreams, f) == (size_t) g->numStreams &&
+	fwrite(g->q, sizeof(GoldenQuad), g->quads, f) == (size_t) g->quads;
+}
+
+static int ReadFlurry(FILE *f, GoldenFlurry *g)
+{
+    if (fread(&g->numStreams, sizeof(int), 3, f) != 3 ||
+	    g->numStreams < 0 || g->numStreams > MAX_SPARKS ||
+	    g->numLive < 0 || g->numLive > NUMSMOKEPARTICLES ||
+	    g->quads < 0 || g->quads > NUMSMOKEPARTICLES)
+	return 0;
+    return fread(g->p, sizeof(GoldenParticle), g->numLive, f) == (size_t) g->numLive &&
+	fread(g->spark, sizeof(g->spark[0]), g->numStreams, f) == (size_t) g->numStreams &&
+	fread(g->q, sizeof(GoldenQuad), g->quads, f) == (size_t) g->quads;
+}
+
+/* Returns 1 if the preset passed and 0 if it failed.  -1 means the
+   check file can't be followed any further: its header was unreadable
+   or its records ran out, so the next preset's would be read from the
+   wrong place. */
+static int GoldenPreset(const GoldenOptions *opts, int preset, FILE *dump, FILE *check)
+{
+    GoldenScene ref, cand;
+    GoldenHeader h, fh;
+    GoldenFlurry *expected = NULL;
+    long records = 0, expect = 0;
+    int frame, n, ok = 1, lost = 0;
+
+    worstUlp = 0;
+    if (!GoldenCreate(&ref, opts, preset, OPT_MODE_SCALAR_BASE)) {
+	fprintf(stderr, "golden: out of memory\n");
+	return 0;
+    }
+    if (!GoldenCreate(&cand, opts, preset, opts->optMode)) {
+	fprintf(stderr, "golden: out of memory\n");
+	GoldenDestroy(&ref);
+	return 0;
+    }
+    cand.global.fusedSmoke = opts->fused;
+
+    memset(&h, 0, sizeof(h));
+    h.magic = GOLDEN_MAGIC;
+    h.version = GOLDEN_VERSION;
+    h.preset = preset;
+    h.frames = opts->frames;
+    h.seed = opts->seed;
+    h.numFlurries = ref.numFlurries;
+    h.dt = opts->dt;
+
+    if (dump && fwrite(&h, sizeof(h), 1, dump) != 1) {
+	fprintf(stderr, "golden: write failed\n");
+	ok = 0;
+    }
+
+    if (check) {
+	if (fread(&fh, sizeof(fh), 1, check) != 1 || fh.magic != GOLDEN_MAGIC ||
+		fh.version != GOLDEN_VERSION || fh.frames < 0 || fh.numFlurries < 0) {
+	    fprintf(stderr, "golden: not a golden file (or wrong version)\n");
+	    ok = 0;
+	    lost = 1;
+	} else if (!(expected = malloc(sizeof(GoldenFlurry)))) {
+	    ok = 0;
+	    lost = 1;
+	} else {
+	    expect = (long) fh.frames * fh.numFlurries;
+	    if (fh.preset != h.preset || fh.frames != h.frames ||
+		    fh.seed != h.seed || fh.numFlurries != h.numFlurries || fh.dt != h.dt) {
+		fprintf(stderr, "golden: file was recorded with different "
+			"preset, seed, frames or dt\n");
+		ok = 0;
+	    }
+	}
+    }
+
+    for (frame = 0; ok && frame < opts->frames; frame++) {
+	double now = (frame + 1) * opts->dt;
+
+	if (opts->resync)
+	    GoldenResync(&cand, &ref);
+	GoldenStep(&ref, now, opts->dt);
+	GoldenStep(&cand, now, opts->dt);
+
+	for (n = 0; ok && n < ref.numFlurries; n++) {
+	    if (dump && !WriteFlurry(dump, &ref.capture[n])) {
+		fprintf(stderr, "golden: write failed\n");
+		ok = 0;
+	    }
+	    if (check) {
+		if (!ReadFlurry(check, expected)) {
+		    fprintf(stderr, "golden: golden file is truncated\n");
+		    ok = 0;
+		    lost = 1;
+		    break;
+		}
+		records++;
+		if (!CompareFlurry(opts, frame, n, expected, &ref.capture[n])) {
+		    printf("golden: (reference kernel against %s)\n", opts->check);
+		    ok = 0;
+		}
+	    }
+	    if (ok && !CompareFlurry(opts, frame, n, &ref.capture[n], &cand.capture[n]))
+		ok = 0;
+	}
+    }
+
+    /* step over what's left of a failed preset, to the next one's header */
+    for (; check && !lost && records < expect; records++) {
+	if (!ReadFlurry(check, expected)) {
+	    fprintf(stderr, "golden: golden file is truncated\n");
+	    lost = 1;
+	}
+    }
+
+    if (ok)
+	printf("golden: %-11s %s: %d frames, %d flurries: ok (worst %u ulp)\n",
+	       PresetName(preset), OptModeName(opts->optMode), opts->frames,
+	       ref.numFlurries, worstUlp);
+    else
+	printf("golden: %-11s FAILED\n", PresetName(preset));
+
+    free(expected);
+    GoldenDestroy(&ref);
+    GoldenDestroy(&cand);
+    return lost ? -1 : ok;
+}
+
+static int GoldenUsage(void)
+{
+    fprintf(stderr,
+	    "usage: flurry -golden [-preset name|all] [-frames n] [-seed n] [-dt s]\n"
+	    "                      [-mode name] [-ulp n] [-rtol x] [-resync] [-lod px]\n"
+	    "                      [-substep hz] [-prep n] [-fused]\n"
+	    "                      [-dump file | -check file]\n"
+	    "  -mode    kernel under test: scalar, vector, avx2, avx512 or auto\n"
+	    "           (default: FLURRY_KERNEL, or auto)\n"
+	    "  -ulp     accept differences up to n units in the last place\n"
+	    "  -rtol    accept differences up to x relative to the larger value\n"
+	    "  -resync  restart the candidate from the reference every frame so\n"
+	    "           only the error of a single step is measured\n"
+	    "  -prep    build the quads on n threads (flurry-prep.c); check against\n"
+	    "           a dump made without, as it's used by both runs\n"
+	    "  -fused   update and draw the candidate's smoke in one pass\n"
+	    "  -dump    write the reference run to file\n"
+	    "  -check   also compare the reference run against file\n");
+    return 2;
+}
+
+int GoldenMain(int argc, char **argv)
+{
+    GoldenOptions opts;
+    FILE *dump = NULL, *check = NULL;
+    int i, preset, r, ok = 1;
+
+    memset(&opts, 0, sizeof(opts));
+    opts.all = 1;
+    opts.frames = 300;
+    opts.seed = 1;
+    opts.dt = 1.0 / 60.0;
+    opts.optMode = SelectOptMode();
+
+    for (i = 1; i < argc; i++) {
+	if (!strcmp(argv[i], "-preset") && i + 1 < argc) {
+	    i++;
+	    if (strcmp(argv[i], "all")) {
+		opts.all = 0;
+		if ((opts.preset = ParsePreset(argv[i])) == PRESET_UNKNOWN)
+		    return GoldenUsage();
+	    }
+	} else if (!strcmp(argv[i], "-frames") && i + 1 < argc) {
+	    opts.frames = atoi(argv[++i]);
+	} else if (!strcmp(argv[i], "-seed") && i + 1 < argc) {
+	    opts.seed = strtoul(argv[++i], NULL, 0);
+	} else if (!strcmp(argv[i], "-dt") && i + 1 < argc) {
+	    opts.dt = atof(argv[++i]);
+	} else if (!strcmp(argv[i], "-mode") && i + 1 < argc) {
+	    if ((opts.optMode = ParseOptMode(argv[++i])) < 0 ||
+		    !OptModeSupported(opts.optMode)) {
+		fprintf(stderr, "golden: kernel %s not available\n", argv[i]);
+		return 2;
+	    }
+	} else if (!strcmp(argv[i], "-ulp") && i + 1 < argc) {
+	    opts.maxUlp = strtoul(argv[++i], NULL, 0);
+	} else if (!strcmp(argv[i], "-rtol") && i + 1 < argc) {
+	    opts.rtol = atof(argv[++i]);
+	} else if (!strcmp(argv[i], "-lod") && i + 1 < argc) {
+	    opts.lodWidth = atof(argv[++i]);
+	} else if (!strcmp(argv[i], "-substep") && i + 1 < argc) {
+	    opts.substepRate = atof(argv[++i]);
+	} else if (!strcmp(argv[i], "-prep") && i + 1 < argc) {
+	    if (!PrepStart(atoi(argv[++i])))
+		return 2;
+	} else if (!strcmp(argv[i], "-fused")) {
+	    opts.fused = 1;
+	} else if (!strcmp(argv[i], "-resync")) {
+	    opts.resync = 1;
+	} else if (!strcmp(argv[i], "-dump") && i + 1 < argc) {
+	    opts.dump = argv[++i];
+	} else if (!strcmp(argv[i], "-check") && i + 1 < argc) {
+	    opts.check = argv[++i];
+	} else {
+	    return GoldenUsage();
+	}
+    }
+
+    if (opts.frames <= 0 || opts.dt <= 0.0 || (opts.dump && opts.check))
+	return GoldenUsage();
+
+    if (opts.dump && !(dump = fopen(opts.dump, "wb"))) {
+	perror(opts.dump);
+	return 2;
+    }
+    if (opts.check && !(check = fopen(opts.check, "rb"))) {
+	perror(opts.check);
+	return 2;
+    }
+
+    if (opts.all) {
+	for (preset = PRESET_INSANE; preset < PRESET_MAX; preset++) {
+	    if ((r = GoldenPreset(&opts, preset, dump, check)) < 0) {
+		fprintf(stderr, "golden: lost our place in %s, stopping\n", opts.check);
+		ok = 0;
+		break;
+	    }
+	    ok &= r;
+	}
+    } else {
+	ok = GoldenPreset(&opts, opts.preset, dump, check) > 0;
+    }
+
+    if (dump && fclose(dump)) {
+	perror(opts.dump);
+	ok = 0;
+    }
+    if (check)
+	fclose(check);
+
+    return ok ? 0 : 1;
+}
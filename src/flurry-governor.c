@@ -0,0 +1,116 @@
+/*
+
+Copyright (c) 2002, Calum Robinson
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+* Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/* Governor.c: adaptive quality.
+
+   Watches how long each frame takes to simulate and draw and shrinks or
+   grows the smoke particle cap of every flurry to keep that time inside
+   a budget.  Only the cap moves: colours, stream counts and speeds stay
+   as the preset made them, so a weak machine sees shorter trails rather
+   than a different flurry.  Cutting is quick and growing is slow, and
+   after every step the governor waits for the average to settle, which
+   keeps the trails from visibly pumping. */
+
+#include <flurry.h>
+
+#define MIN_QUALITY	0.1f
+#define SMOOTHING	0.1f	/* weight of the newest frame */
+#define GROW_BELOW	0.7f	/* of budget */
+#define SHRINK_AFTER	10	/* frames over budget */
+#define GROW_AFTER	120	/* frames well under budget */
+#define SHRINK_STEP	0.85f
+#define GROW_STEP	0.05f
+#define SETTLE_FRAMES	30
+
+void GovernorInit(Governor *g, float budget)
+{
+    g->budget = budget;
+    g->average = 0.0f;
+    g->quality = 1.0f;
+    g->over = 0;
+    g->under = 0;
+    g->cooldown = 0;
+}
+
+static void GovernorApply(global_info_t *global)
+{
+    flurry_info_t *flurry;
+    int groups = (int) (global->governor.quality * (NUMSMOKEPARTICLES/4));
+
+    for (flurry = global->flurry; flurry; flurry = flurry->next)
+	SetSmokeCap(flurry->s, groups);
+}
+
+/* `work' is the time spent on the last frame, excluding any wait for
+   the frame clock or vertical retrace */
+void GovernorUpdate(global_info_t *global, double work)
+{
+    Governor *g = &global->governor;
+    float quality = g->quality;
+
+    if (g->budget <= 0.0f)
+	return;
+
+    if (g->average == 0.0f)
+	g->average = (float) work;
+    else
+	g->average += ((float) work - g->average) * SMOOTHING;
+
+    if (g->cooldown > 0) {
+	g->cooldown--;
+	return;
+    }
+
+    if (g->average > g->budget) {
+	g->over++;
+	g->under = 0;
+    } else if (g->average < g->budget * GROW_BELOW) {
+	g->under++;
+	g->over = 0;
+    } else {
+	g->over = 0;
+	g->under = 0;
+    }
+
+    if (g->over >= SHRINK_AFTER)
+	quality = MAX_(MIN_QUALITY, g->quality * SHRINK_STEP);
+    else if (g->under >= GROW_AFTER)
+	quality = MIN_(1.0f, g->quality + GROW_STEP);
+
+    if (quality != g->quality) {
+	g->quality = quality;
+	g->over = 0;
+	g->under = 0;
+	g->cooldown = SETTLE_FRAMES;
+	GovernorApply(global);
+    }
+}
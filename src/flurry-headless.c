@@ -0,0 +1,186 @@
+/*
+
+Copyright (c) 2002, Calum Robinson
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+* Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+/* Headless.c: flurry with no X server and no GL, into the frame sink.
+
+   flurry -headless steps a scene on a fixed clock, frame n at n / fps
+   seconds, draws it with the CPU rasterizer (flurry-raster.c) and
+   resolves each frame straight into the next slot of the shared ring
+   (flurry-sink.c), so a consumer maps the very bytes drawn.  The scene
+   runs with the -accum tuning, since the rasterizer blends in float.
+   Frames are paced to the wall clock unless -fast is given; the clock
+   the scene sees is the same either way. */
+
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <flurry.h>
+
+#define HEADLESS_SEED 1		/* as the windowed flurry's first tile */
+
+static volatile sig_atomic_t headlessQuit = 0;
+
+static void HeadlessSignal(int sig)
+{
+    (void) sig;
+    headlessQuit = 1;
+}
+
+static int HeadlessUsage(void)
+{
+    fprintf(stderr,
+	    "usage: flurry -headless -sink socket [-preset name] [-size WxH] [-fps hz]\n"
+	    "                        [-frames n] [-slots n] [-mode name] [-field n]\n"
+	    "                        [-prep n] [-fused] [-fast]\n"
+	    "  -sink      Unix socket handing out the frame ring's memfd\n"
+	    "  -size      frame size, 640x480 by default\n"
+	    "  -fps       frames per second of scene time, 60 by default\n"
+	    "  -frames    stop after this many; run until killed by default\n"
+	    "  -slots     frames in the ring, 3 by default\n"
+	    "  -prep      threads building each flurry's quads\n"
+	    "  -fused     update and draw the smoke in one pass\n"
+	    "  -fast      don't wait for the wall clock between frames\n");
+    return 2;
+}
+
+int HeadlessMain(int argc, char **argv)
+{
+    global_info_t *scene;
+    SceneFrame frame;
+    Raster raster;
+    struct timespec next;
+    const char *path = NULL, *presetName = "random";
+    unsigned char *pixels;
+    double fps = 60.0, now;
+    long frames = -1, n;
+    int i, width = 640, height = 480, slots = 3, mode = -1, field = 0;
+    int fast = 0, fused = 0, preset, stride;
+
+    for (i = 1; i < argc; i++) {
+	if (!strcmp(argv[i], "-sink") && i + 1 < argc) {
+	    path = argv[++i];
+	} else if (!strcmp(argv[i], "-preset") && i + 1 < argc) {
+	    presetName = argv[++i];
+	} else if (!strcmp(argv[i], "-size") && i + 1 < argc) {
+	    if (sscanf(argv[++i], "%dx%d", &width, &height) != 2 ||
+		width <= 0 || height <= 0 || width > 16384 || height > 16384)
+		return HeadlessUsage();
+	} else if (!strcmp(argv[i], "-fps") && i + 1 < argc) {
+	    if ((fps = atof(argv[++i])) <= 0.0)
+		return HeadlessUsage();
+	} else if (!strcmp(argv[i], "-frames") && i + 1 < argc) {
+	    frames = atol(argv[++i]);
+	} else if (!strcmp(argv[i], "-slots") && i + 1 < argc) {
+	    if ((slots = atoi(argv[++i])) < 1 || slots > 64)
+		return HeadlessUsage();
+	} else if (!strcmp(argv[i], "-mode") && i + 1 < argc) {
+	    if ((mode = ParseOptMode(argv[++i])) < 0 || !OptModeSupported(mode))
+		return HeadlessUsage();
+	} else if (!strcmp(argv[i], "-field") && i + 1 < argc) {
+	    field = atoi(argv[++i]);
+	    if (field != 0 && !FieldGridValid(field))
+		return HeadlessUsage();
+	} else if (!strcmp(argv[i], "-prep") && i + 1 < argc) {
+	    if (!PrepStart(atoi(argv[++i])))
+		return 1;
+	} else if (!strcmp(argv[i], "-fused")) {
+	    fused = 1;
+	} else if (!strcmp(argv[i], "-fast")) {
+	    fast = 1;
+	} else {
+	    return HeadlessUsage();
+	}
+    }
+    if (!path)
+	return HeadlessUsage();
+    if ((preset = ParsePreset(presetName)) == PRESET_UNKNOWN)
+	return 2;
+
+    if (!(scene = SceneCreate(PRESET_UNKNOWN, width, height, HEADLESS_SEED, 0.0)))
+	return 1;
+    scene->accumulate = 1;
+    scene->fieldGrid = field;
+    scene->fusedSmoke = fused;
+    if (mode >= 0)
+	scene->optMode = mode;
+    /* time the field before the first frame */
+    FieldFrom(field, scene->optMode);
+    if (!CreatePreset(scene, preset, 0.0) || !SceneFrameInit(&frame, scene)) {
+	SceneDestroy(scene);
+	return 1;
+    }
+    /* the texture from the scene's generator, as begin_frame (flurry.c)
+       makes it before the first frame is drawn */
+    if (!RasterInit(&raster, width, height, &scene->rng)) {
+	SceneFrameFree(&frame);
+	SceneDestroy(scene);
+	return 1;
+    }
+    if (!SinkOpen(path, width, height, slots)) {
+	RasterFree(&raster);
+	SceneFrameFree(&frame);
+	SceneDestroy(scene);
+	return 1;
+    }
+
+    /* leave by returning, so the socket is unlinked at exit */
+    signal(SIGINT, HeadlessSignal);
+    signal(SIGTERM, HeadlessSignal);
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (n = 0; (frames < 0 || n < frames) && !headlessQuit; n++) {
+	now = n / fps;
+	SceneStepBuild(scene, now, &frame);
+	RasterFrame(&raster, &frame.staging, frame.allQuads, frame.alpha);
+
+	pixels = SinkBegin(&stride);
+	RasterResolve(&raster, pixels, stride);
+	SinkPublish(now);
+
+	if (!fast) {
+	    next.tv_nsec += (long) (1e9 / fps);
+	    while (next.tv_nsec >= 1000000000L) {
+		next.tv_nsec -= 1000000000L;
+		next.tv_sec++;
+	    }
+	    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) &&
+		   !headlessQuit)
+		;
+	}
+    }
+
+    RasterFree(&raster);
+    SceneFrameFree(&frame);
+    SceneDestroy(scene);
+    return 0;
+}
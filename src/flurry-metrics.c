@@ -0,0 +1,333 @@
+/*
+
+Copyright (c) 2002, Calum Robinson
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+* Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+/* Metrics.c: Prometheus text exposition for monitoring.
+
+   With -metrics the render thread hands a MetricsSample to MetricsFrame
+   once a frame.  That only copies it into a ring and moves the head
+   along, so drawing never waits on anything here; if the stats thread
+   falls a whole ring behind, the oldest samples are lost and counted.
+
+   The stats thread owns everything else.  It drains the ring every
+   METRICS_DRAIN_MS and on every connection to the socket, a Unix domain
+   socket or a port on 127.0.0.1, which gets one HTTP/1.0 response in
+   the Prometheus text format and is closed.  So curl, or a scraper
+   behind a socket proxy, sees the totals since start, frame work time
+   quantiles and the frame rate over the last METRICS_WINDOW frames, the
+   particles and quads of the last frame, and the CPU time of the
+   process. */
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <flurry.h>
+
+#define METRICS_RING 1024	/* samples, a power of two */
+#define METRICS_WINDOW 600	/* frames the quantiles are taken over */
+#define METRICS_DRAIN_MS 1000
+#define METRICS_REQUEST_MS 200	/* to wait for the client's request */
+#define METRICS_BODY 4096
+
+int metricsEnabled = 0;
+
+/* written by the render thread only */
+static MetricsSample ring[METRICS_RING];
+static volatile unsigned long ringHead = 0;
+
+/* the rest belongs to the stats thread */
+static unsigned long ringTail = 0;
+static int listenFd = -1;
+static char socketPath[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+
+static unsigned long frames, dropped, lost;
+static double workSum;
+static float work[METRICS_WINDOW], interval[METRICS_WINDOW];
+static int windowIndex, windowCount;
+static int lastLive, lastQuads;
+
+void MetricsFrame(const MetricsSample *sample)
+{
+    unsigned long head = ringHead;
+
+    ring[head & (METRICS_RING - 1)] = *sample;
+    /* the sample is in place before the head that covers it */
+    __sync_synchronize();
+    ringHead = head + 1;
+}
+
+static void MetricsDrain(void)
+{
+    unsigned long head = ringHead, i;
+    MetricsSample s;
+
+    __sync_synchronize();
+    if (head - ringTail > METRICS_RING) {
+	lost += head - METRICS_RING - ringTail;
+	ringTail = head - METRICS_RING;
+    }
+    for (i = ringTail; i != head; i++) {
+	s = ring[i & (METRICS_RING - 1)];
+	/* the render thread may have lapped us while we copied */
+	__sync_synchronize();
+	if (ringHead - i > METRICS_RING - 1) {
+	    lost++;
+	    continue;
+	}
+
+	frames++;
+	dropped += s.dropped;
+	workSum += s.work;
+	work[windowIndex] = (float) s.work;
+	interval[windowIndex] = (float) s.interval;
+	windowIndex = (windowIndex + 1) % METRICS_WINDOW;
+	if (windowCount < METRICS_WINDOW)
+	    windowCount++;
+	lastLive = s.live;
+	lastQuads = s.quads;
+    }
+    ringTail = head;
+}
+
+static int compareFloat(const void *a, const void *b)
+{
+    float x = *(const float *) a;
+    float y = *(const float *) b;
+
+    return (x > y) - (x < y);
+}
+
+static int MetricsBody(char *body, int room)
+{
+    static const float quantiles[] = { 0.5f, 0.9f, 0.99f };
+    float sorted[METRICS_WINDOW];
+    double seconds = 0.0, fps = 0.0;
+    struct rusage ru;
+    int i, len = 0, timed = 0;
+
+#define EMIT(...) \
+    do { if (len < room) len += snprintf(body + len, room - len, __VA_ARGS__); } while (0)
+
+    EMIT("# HELP flurry_frames_total Frames drawn.\n"
+	 "# TYPE flurry_frames_total counter\n"
+	 "flurry_frames_total %lu\n", frames);
+    EMIT("# HELP flurry_frames_dropped_total Frame ticks missed while a frame ran late.\n"
+	 "# TYPE flurry_frames_dropped_total counter\n"
+	 "flurry_frames_dropped_total %lu\n", dropped);
+
+    memcpy(sorted, work, windowCount * sizeof(float));
+    qsort(sorted, windowCount, sizeof(float), compareFloat);
+    EMIT("# HELP flurry_frame_seconds Simulation and GL work per frame; quantiles over the last %d frames.\n"
+	 "# TYPE flurry_frame_seconds summary\n", METRICS_WINDOW);
+    for (i = 0; i < (int) (sizeof(quantiles) / sizeof(quantiles[0])); i++)
+	EMIT("flurry_frame_seconds{quantile=\"%g\"} %.6f\n", quantiles[i],
+	     windowCount ? sorted[(int) ((windowCount - 1) * quantiles[i])] : 0.0f);
+    EMIT("flurry_frame_seconds_sum %.6f\n"
+	 "flurry_frame_seconds_count %lu\n", workSum, frames);
+
+    /* the first frame after a start or a pause has no interval */
+    for (i = 0; i < windowCount; i++) {
+	if (interval[i] > 0.0f) {
+	    seconds += interval[i];
+	    timed++;
+	}
+    }
+    if (seconds > 0.0)
+	fps = timed / seconds;
+    EMIT("# HELP flurry_fps Frame rate over the last %d frames.\n"
+	 "# TYPE flurry_fps gauge\n"
+	 "flurry_fps %.2f\n", METRICS_WINDOW, fps);
+    EMIT("# HELP flurry_live_particles Live smoke particles in the last frame.\n"
+	 "# TYPE flurry_live_particles gauge\n"
+	 "flurry_live_particles %d\n", lastLive);
+    EMIT("# HELP flurry_quads Quads drawn in the last frame.\n"
+	 "# TYPE flurry_quads gauge\n"
+	 "flurry_quads %d\n", lastQuads);
+    EMIT("# HELP flurry_metrics_lost_total Frame samples overwritten before the stats thread read them.\n"
+	 "# TYPE flurry_metrics_lost_total counter\n"
+	 "flurry_metrics_lost_total %lu\n", lost);
+
+    if (!getrusage(RUSAGE_SELF, &ru)) {
+	EMIT("# HELP process_cpu_seconds_total User and system CPU time.\n"
+	     "# TYPE process_cpu_seconds_total counter\n"
+	     "process_cpu_seconds_total %.3f\n",
+	     ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+	     (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000000.0);
+    }
+#undef EMIT
+    return MIN_(len, room - 1);
+}
+
+static int MetricsWrite(int fd, const char *buf, int len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+	if ((n = send(fd, buf, len, MSG_NOSIGNAL)) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return 0;
+	}
+	buf += n;
+	len -= n;
+    }
+    return 1;
+}
+
+/* whatever was asked, the answer is the whole exposition */
+static void MetricsServe(int fd)
+{
+    char body[METRICS_BODY], head[128], request[1024];
+    struct pollfd pfd;
+    int len;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, METRICS_REQUEST_MS) > 0 &&
+	read(fd, request, sizeof(request)) < 0)
+	return;
+
+    len = MetricsBody(body, sizeof(body));
+    snprintf(head, sizeof(head), "HTTP/1.0 200 OK\r\n"
+	     "Content-Type: text/plain; version=0.0.4\r\n"
+	     "Content-Length: %d\r\n\r\n", len);
+    if (MetricsWrite(fd, head, strlen(head)))
+	MetricsWrite(fd, body, len);
+}
+
+static void *MetricsThread(void *arg)
+{
+    struct pollfd pfd;
+    int fd, n;
+
+    (void) arg;
+    pfd.fd = listenFd;
+    pfd.events = POLLIN;
+    for (;;) {
+	n = poll(&pfd, 1, METRICS_DRAIN_MS);
+	MetricsDrain();
+	if (n <= 0 || !(pfd.revents & POLLIN))
+	    continue;
+	if ((fd = accept(listenFd, NULL, NULL)) < 0)
+	    continue;
+	MetricsServe(fd);
+	close(fd);
+    }
+    return NULL;
+}
+
+static void MetricsUnlink(void)
+{
+    unlink(socketPath);
+}
+
+static int MetricsListen(const char *where)
+{
+    struct sockaddr_un un;
+    struct sockaddr_in in;
+    struct stat st;
+    char *end;
+    long port = strtol(where, &end, 10);
+    int fd, one = 1;
+
+    if (*where && !*end) {
+	if (port <= 0 || port > 65535 || (fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+	    return -1;
+	memset(&in, 0, sizeof(in));
+	in.sin_family = AF_INET;
+	in.sin_port = htons((unsigned short) port);
+	in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(fd, (struct sockaddr *) &in, sizeof(in)) < 0 || listen(fd, 4) < 0) {
+	    close(fd);
+	    return -1;
+	}
+	return fd;
+    }
+
+    if (strlen(where) >= sizeof(un.sun_path) ||
+	(fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+	return -1;
+    memset(&un, 0, sizeof(un));
+    un.sun_family = AF_UNIX;
+    strcpy(un.sun_path, where);
+    /* a socket left behind by an earlier run, but nothing else */
+    if (lstat(where, &st) == 0) {
+	if (!S_ISSOCK(st.st_mode)) {
+	    close(fd);
+	    errno = EEXIST;
+	    return -1;
+	}
+	unlink(where);
+    }
+    if (bind(fd, (struct sockaddr *) &un, sizeof(un)) < 0 || listen(fd, 4) < 0) {
+	close(fd);
+	return -1;
+    }
+    strcpy(socketPath, where);
+    atexit(MetricsUnlink);
+    return fd;
+}
+
+int MetricsOpen(const char *where)
+{
+    pthread_t thread;
+    sigset_t all, old;
+    int ok;
+
+    if ((listenFd = MetricsListen(where)) < 0) {
+	perror(where);
+	return 0;
+    }
+
+    /* signals are for the render loop */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    ok = !pthread_create(&thread, NULL, MetricsThread, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (!ok) {
+	fprintf(stderr, "%s: can't start the stats thread\n", where);
+	close(listenFd);
+	return 0;
+    }
+    pthread_detach(thread);
+    metricsEnabled = 1;
+    return 1;
+}
@@ -0,0 +1,130 @@
+/*
+
+Copyright (c) 2002, Calum Robinson
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+* Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/* Pipeline.c: hand frames from a producer thread to the render thread.
+
+   There are two frame slots.  The producer fills whichever slot is free
+   and marks it full; the render thread takes full slots in order, draws
+   from them and gives them back.  So while frame N is being drawn from
+   one slot, frame N+1 is being prepared in the other, and neither side
+   ever touches a slot the other one holds. */
+
+#include <flurry.h>
+
+static void *PipelineThread(void *arg)
+{
+    Pipeline *p = arg;
+    int slot = 0;
+
+    TraceThreadName("sim");
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+	while (p->full[slot] && !p->quit)
+	    pthread_cond_wait(&p->cond, &p->lock);
+	if (p->quit)
+	    break;
+	p->busy = 1;
+	pthread_mutex_unlock(&p->lock);
+
+	p->produce(p->ctx, slot);
+
+	pthread_mutex_lock(&p->lock);
+	p->busy = 0;
+	p->full[slot] = 1;
+	pthread_cond_broadcast(&p->cond);
+	slot ^= 1;
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+int PipelineStart(Pipeline *p, void (*produce)(void *ctx, int slot), void *ctx)
+{
+    p->full[0] = p->full[1] = 0;
+    p->next = 0;
+    p->busy = 0;
+    p->quit = 0;
+    p->produce = produce;
+    p->ctx = ctx;
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->cond, NULL);
+    if (pthread_create(&p->thread, NULL, PipelineThread, p)) {
+	pthread_cond_destroy(&p->cond);
+	pthread_mutex_destroy(&p->lock);
+	return 0;
+    }
+    return 1;
+}
+
+/* blocks until the next frame is ready and returns its slot */
+int PipelineAcquire(Pipeline *p)
+{
+    int slot;
+
+    pthread_mutex_lock(&p->lock);
+    slot = p->next;
+    while (!p->full[slot])
+	pthread_cond_wait(&p->cond, &p->lock);
+    p->next ^= 1;
+    pthread_mutex_unlock(&p->lock);
+    return slot;
+}
+
+void PipelineRelease(Pipeline *p, int slot)
+{
+    pthread_mutex_lock(&p->lock);
+    p->full[slot] = 0;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+}
+
+/* Waits for the producer to finish what it is doing.  It then stays
+   parked until a slot is released, so the caller may touch the state
+   it works on. */
+void PipelineIdle(Pipeline *p)
+{
+    pthread_mutex_lock(&p->lock);
+    while (p->busy || !(p->full[0] && p->full[1]))
+	pthread_cond_wait(&p->cond, &p->lock);
+    pthread_mutex_unlock(&p->lock);
+}
+
+void PipelineStop(Pipeline *p)
+{
+    pthread_mutex_lock(&p->lock);
+    p->quit = 1;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+    pthread_join(p->thread, NULL);
+    pthread_cond_destroy(&p->cond);
+    pthread_mutex_destroy(&p->lock);
+}
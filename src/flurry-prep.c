@@ -0,0 +1,210 @@
+/*
+
+Copyright (c) 2002, Calum Robinson
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+* Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+/* Prep.c: a flurry's quads built on several threads at once.
+
+   The draw kernels keep one running output index, so on their own they
+   build a flurry's quads in order on one thread; once the update is
+   spread out, that is what the frame waits on.  With -prep n the
+   groups of each flurry are cut into n ranges, PREP_ALIGN groups apart,
+   and the calling thread and n - 1 workers each run the kernel on one.
+   A range can't make more quads than it has particles, so each writes
+   into its own slice of the staging, at the quad its first particle
+   would have: no two touch the same bytes, and no lock is taken until
+   the range is done.  The per-range counts are then summed in order and
+   the slices moved down to close the gaps, which gives the same packed
+   quads, in the same order, as one kernel running over the lot.
+
+   What the kernels change besides the staging, a particle's animation
+   frame and its death when it has spread too wide, belongs to that
+   particle, so it is done by whichever thread has its range; the live
+   counts are added up like the quads.
+
+   There is one pool.  A second scene drawing while it is busy, or a
+   flurry too small to be worth it, is drawn on the caller's thread. */
+
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <flurry.h>
+
+#define PREP_MAX_THREADS 16
+#define PREP_ALIGN 4		/* groups; the widest kernel's vector */
+#define PREP_MIN_GROUPS 64	/* per thread, or it isn't worth the wakeup */
+
+typedef struct PrepSlice
+{
+    int first, last;		/* groups */
+    int quads;
+    int live;
+} PrepSlice;
+
+int prepThreads = 0;
+
+static pthread_mutex_t prepBusy = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t prepLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prepStart = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t prepDone = PTHREAD_COND_INITIALIZER;
+static unsigned int prepGeneration;
+static int prepPending;
+
+/* this round's work, set under prepLock */
+static global_info_t *prepGlobal;
+static flurry_info_t *prepFlurry;
+static SmokeStaging *prepStaging;
+static float prepBrightness;
+static int prepSlices;
+static PrepSlice slices[PREP_MAX_THREADS];
+
+static void PrepRun(int index)
+{
+    PrepSlice *slice = &slices[index];
+    SmokeStaging st;
+
+    TraceBegin("prep", index);
+    SliceSmokeStaging(&st, prepStaging, slice->first * 4, (slice->last - slice->first) * 4);
+    slice->live = 0;
+    slice->quads = DrawSmokeRange(prepGlobal, prepFlurry, prepFlurry->s, &st, prepBrightness,
+				  slice->first, slice->last, &slice->live);
+    TraceEnd("prep", index);
+}
+
+static void *PrepThread(void *arg)
+{
+    int index = (int) (long) arg;
+    unsigned int seen = 0;
+    char name[16];
+
+    sprintf(name, "prep %d", index);
+    TraceThreadName(name);
+    for (;;) {
+	pthread_mutex_lock(&prepLock);
+	while (prepGeneration == seen)
+	    pthread_cond_wait(&prepStart, &prepLock);
+	seen = prepGeneration;
+	pthread_mutex_unlock(&prepLock);
+
+	if (index < prepSlices)
+	    PrepRun(index);
+
+	pthread_mutex_lock(&prepLock);
+	if (!--prepPending)
+	    pthread_cond_signal(&prepDone);
+	pthread_mutex_unlock(&prepLock);
+    }
+    return NULL;
+}
+
+int PrepStart(int threads)
+{
+    pthread_t thread;
+    sigset_t all, old;
+    long i;
+    int ok = 1;
+
+    threads = MIN_(PREP_MAX_THREADS, threads);
+    if (threads < 2)
+	return 1;
+
+    /* signals are for the render loop */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    for (i = 1; i < threads && ok; i++) {
+	if ((ok = !pthread_create(&thread, NULL, PrepThread, (void *) i)))
+	    pthread_detach(thread);
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    /* carry on with the ones that did start; they only wait for work */
+    if (!ok) {
+	threads = i - 1;
+	fprintf(stderr, "-prep: only %d draw threads\n", threads);
+    }
+    prepThreads = threads;
+    return 1;
+}
+
+int DrawSmoke_Parallel(global_info_t *global, flurry_info_t *flurry, SmokeV *s,
+		       SmokeStaging *st, float brightness)
+{
+    int n, i, per, quads, live;
+
+    n = MIN_(prepThreads, s->numGroups / PREP_MIN_GROUPS);
+    if (n < 2 || st->quads < s->numGroups * 4 || pthread_mutex_trylock(&prepBusy))
+	return -1;
+
+    per = ((s->numGroups + n - 1) / n + PREP_ALIGN - 1) & ~(PREP_ALIGN - 1);
+    for (i = 0; i < n; i++) {
+	slices[i].first = MIN_(s->numGroups, i * per);
+	slices[i].last = MIN_(s->numGroups, (i + 1) * per);
+    }
+    slices[n - 1].last = s->numGroups;
+
+    pthread_mutex_lock(&prepLock);
+    prepGlobal = global;
+    prepFlurry = flurry;
+    prepStaging = st;
+    prepBrightness = brightness;
+    prepSlices = n;
+    prepPending = prepThreads - 1;
+    prepGeneration++;
+    pthread_cond_broadcast(&prepStart);
+    pthread_mutex_unlock(&prepLock);
+
+    PrepRun(0);
+
+    pthread_mutex_lock(&prepLock);
+    while (prepPending)
+	pthread_cond_wait(&prepDone, &prepLock);
+    pthread_mutex_unlock(&prepLock);
+
+    /* close the gaps, front to back; a slice only ever moves down */
+    quads = slices[0].quads;
+    live = slices[0].live;
+    for (i = 1; i < n; i++) {
+	int from = slices[i].first * 4, count = slices[i].quads;
+
+	if (count && from != quads) {
+	    memmove(st->seraphimVertices + quads * 2, st->seraphimVertices + from * 2,
+		    count * 2 * sizeof(floatToVector));
+	    memmove(st->seraphimColors + quads * 4, st->seraphimColors + from * 4,
+		    count * 4 * sizeof(floatToVector));
+	    memmove(st->seraphimTextures + quads * 8, st->seraphimTextures + from * 8,
+		    count * 8 * sizeof(float));
+	}
+	quads += count;
+	live += slices[i].live;
+    }
+    s->live = live;
+
+    pthread_mutex_unlock(&prepBusy);
+    return quads;
+}
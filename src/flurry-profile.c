@@ -0,0 +1,306 @@
+/*
+
+Copyright (c) 2002, Calum Robinson
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+* Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/* Profile.c: frame phase timing and the on-screen statistics overlay. */
+
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <flurry.h>
+
+#define PROFILE_WINDOW 128
+
+int profileEnabled = 0;
+
+static const char *phaseNames[PHASE_MAX] = {
+    "star", "spark", "smoke", "verts", "submit", "fade", "swap", "frame"
+};
+
+/* rolling window of per-frame phase totals, in seconds.  Each thread
+   adds up its own phases; with -pipeline the sim thread hands its
+   totals over in ProfilePublish, at the end of each frame it prepares,
+   and whichever frame the render thread closes next takes them. */
+static float samples[PHASE_MAX][PROFILE_WINDOW];
+static __thread double current[PHASE_MAX];
+static double published[PHASE_MAX];
+static pthread_mutex_t publishLock = PTHREAD_MUTEX_INITIALIZER;
+static int sampleIndex = 0;
+static int sampleCount = 0;
+
+static int live[PROFILE_MAX_FLURRIES];
+static int numFlurries = 0;
+
+/* with -counters: per frame counts for groups of phases, and the
+   particles they were spent on */
+#define COUNTER_GROUPS 3
+
+static const char *groupNames[COUNTER_GROUPS] = { "sim", "verts", "submit" };
+static const ProfilePhase groupLast[COUNTER_GROUPS] = {
+    PHASE_SMOKE, PHASE_VERTS, PHASE_SUBMIT	/* sim is star to smoke */
+};
+static unsigned long long counterSamples[COUNTER_GROUPS][COUNTER_MAX][PROFILE_WINDOW];
+static int particleSamples[PROFILE_WINDOW];
+
+static double lastFrame = 0.0;
+static double fps = 0.0;
+
+static GLuint fontBase = 0;
+static int fontHeight = 13;
+
+double ProfileClock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1000000000.0;
+}
+
+double ProfileBegin(ProfilePhase phase)
+{
+    double now = ProfileClock();
+
+    if (traceEnabled)
+	TraceEvent(phaseNames[phase], 'B', now, -1);
+    if (countersEnabled && profileEnabled)
+	CountersBegin(phase);
+    return now;
+}
+
+void ProfileEnd(ProfilePhase phase, double start)
+{
+    double now = ProfileClock();
+
+    if (countersEnabled && profileEnabled)
+	CountersEnd(phase);
+    if (profileEnabled)
+	current[phase] += now - start;
+    if (traceEnabled)
+	TraceEvent(phaseNames[phase], 'E', now, -1);
+}
+
+void ProfileParticles(int index, int count)
+{
+    if (index >= PROFILE_MAX_FLURRIES)
+	return;
+    live[index] = count;
+    if (index >= numFlurries)
+	numFlurries = index + 1;
+}
+
+/* the calling thread's phase totals, for the next frame to be closed */
+void ProfilePublish(void)
+{
+    int i;
+
+    pthread_mutex_lock(&publishLock);
+    for (i = 0; i < PHASE_MAX; i++) {
+	published[i] += current[i];
+	current[i] = 0.0;
+    }
+    pthread_mutex_unlock(&publishLock);
+    if (countersEnabled)
+	CountersPublish();
+}
+
+/* hand over this frame's phase totals, from every thread, without
+   closing the frame */
+void ProfileTakeFrame(double phases[PHASE_MAX])
+{
+    int i;
+
+    ProfilePublish();
+    pthread_mutex_lock(&publishLock);
+    for (i = 0; i < PHASE_MAX; i++) {
+	phases[i] = published[i];
+	published[i] = 0.0;
+    }
+    pthread_mutex_unlock(&publishLock);
+}
+
+void ProfileEndFrame(void)
+{
+    unsigned long long counts[PHASE_MAX][COUNTER_MAX];
+    double phases[PHASE_MAX];
+    int i, j, k, first;
+    double now = ProfileClock();
+
+    ProfileTakeFrame(phases);
+    for (i = 0; i < PHASE_MAX; i++)
+	samples[i][sampleIndex] = (float) phases[i];
+
+    if (countersEnabled) {
+	CountersTakeFrame(counts);
+	for (i = 0, first = 0; i < COUNTER_GROUPS; first = groupLast[i++] + 1) {
+	    for (k = 0; k < COUNTER_MAX; k++) {
+		counterSamples[i][k][sampleIndex] = 0;
+		for (j = first; j <= (int) groupLast[i]; j++)
+		    counterSamples[i][k][sampleIndex] += counts[j][k];
+	    }
+	}
+	particleSamples[sampleIndex] = 0;
+	for (i = 0; i < numFlurries; i++)
+	    particleSamples[sampleIndex] += live[i];
+    }
+    sampleIndex = (sampleIndex + 1) % PROFILE_WINDOW;
+    if (sampleCount < PROFILE_WINDOW)
+	sampleCount++;
+
+    if (lastFrame > 0.0 && now > lastFrame) {
+	/* smooth over roughly a second at 60fps */
+	if (fps == 0.0)
+	    fps = 1.0 / (now - lastFrame);
+	else
+	    fps += (1.0 / (now - lastFrame) - fps) * (1.0 / 60.0);
+    }
+    lastFrame = now;
+}
+
+static int compareFloat(const void *a, const void *b)
+{
+    float x = *(const float *) a;
+    float y = *(const float *) b;
+
+    return (x > y) - (x < y);
+}
+
+static void PhaseStats(ProfilePhase phase, float *min, float *avg, float *p99)
+{
+    float sorted[PROFILE_WINDOW];
+    double sum = 0.0;
+    int i;
+
+    if (!sampleCount) {
+	*min = *avg = *p99 = 0.0f;
+	return;
+    }
+
+    for (i = 0; i < sampleCount; i++) {
+	sorted[i] = samples[phase][i];
+	sum += sorted[i];
+    }
+    qsort(sorted, sampleCount, sizeof(float), compareFloat);
+
+    *min = sorted[0];
+    *avg = (float) (sum / sampleCount);
+    *p99 = sorted[(sampleCount * 99) / 100];
+}
+
+static void CounterLine(char *line, int group)
+{
+    unsigned long long sum[COUNTER_MAX];
+    double particles = 0.0;
+    CounterRatios r;
+    int i, k;
+
+    memset(sum, 0, sizeof(sum));
+    for (i = 0; i < sampleCount; i++) {
+	for (k = 0; k < COUNTER_MAX; k++)
+	    sum[k] += counterSamples[group][k][i];
+	particles += particleSamples[i];
+    }
+    CounterRatiosOf(sum, particles, &r);
+    sprintf(line, "%-7s %5.2f %8.2f %8.3f %5.1f", groupNames[group],
+	    r.ipc, r.missesPerParticle, r.branchMissesPerParticle,
+	    r.stalled < 0.0 ? -1.0 : r.stalled * 100.0);
+}
+
+static void DrawLine(int x, int y, const char *text)
+{
+    glRasterPos2i(x, y);
+    glListBase(fontBase);
+    glCallLists(strlen(text), GL_UNSIGNED_BYTE, text);
+}
+
+void ProfileDrawHUD(Display *dpy, global_info_t *global)
+{
+    char line[128];
+    float min, avg, p99;
+    int i, x, y;
+
+    if (!fontBase) {
+	XFontStruct *font = XLoadQueryFont(dpy, "fixed");
+
+	if (!font)
+	    return;
+	fontBase = glGenLists(256);
+	glXUseXFont(font->fid, 0, 256, fontBase);
+	fontHeight = font->ascent + font->descent;
+	XFreeFont(dpy, font);
+    }
+
+    glDisable(GL_TEXTURE_2D);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
+
+    x = 10;
+    y = (int) global->sys_glHeight - 10 - fontHeight;
+
+    sprintf(line, "%.1f fps  kernel %s", fps, OptModeName(global->optMode));
+    DrawLine(x, y, line);
+    y -= fontHeight;
+
+    if (global->governor.budget > 0.0f) {
+	sprintf(line, "budget %.1f ms  work %.2f ms  quality %.2f",
+		global->governor.budget * 1000.0f,
+		global->governor.average * 1000.0f, global->governor.quality);
+	DrawLine(x, y, line);
+	y -= fontHeight;
+    }
+
+    DrawLine(x, y, "phase      min     avg     p99  (ms)");
+    y -= fontHeight;
+    for (i = 0; i < PHASE_MAX; i++) {
+	PhaseStats(i, &min, &avg, &p99);
+	sprintf(line, "%-7s %7.3f %7.3f %7.3f", phaseNames[i],
+		min * 1000.0f, avg * 1000.0f, p99 * 1000.0f);
+	DrawLine(x, y, line);
+	y -= fontHeight;
+    }
+
+    if (countersEnabled) {
+	DrawLine(x, y, "counter   IPC  miss/pt  brmiss/pt stall%  (-1: n/a)");
+	y -= fontHeight;
+	for (i = 0; i < COUNTER_GROUPS; i++) {
+	    CounterLine(line, i);
+	    DrawLine(x, y, line);
+	    y -= fontHeight;
+	}
+    }
+
+    for (i = 0; i < numFlurries; i++) {
+	sprintf(line, "flurry %d: %d particles", i, live[i]);
+	DrawLine(x, y, line);
+	y -= fontHeight;
+    }
+}
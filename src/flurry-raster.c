@@ -0,0 +1,224 @@
+/*
+
+Copyright (c) 2002, Calum Robinson
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+* Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+/* Raster.c: the smoke quads drawn without GL.
+
+   For hosts with no GL at all (flurry -headless), this draws what
+   SubmitSmoke would: each quad of a SmokeStaging set as the two
+   triangles GL_QUADS makes of it, textured with the same smoke texture
+   and blended the same way, colour times texture, added in proportion
+   to alpha.  The accumulation is float and the fade an exact decay, as
+   with -accum (flurry-accum.c), and RasterResolve clips to 8 bits.
+
+   The texture is sampled nearest texel from the nearest mip level, the
+   level picked per quad from its narrowest side; GL filters within the
+   level too, which this skips. */
+
+#include <string.h>
+
+#include <flurry.h>
+
+#define RASTER_TEXTURE 256	/* a side, at level 0 */
+#define RASTER_CELL 32		/* one animation frame of it */
+
+int RasterInit(Raster *r, int width, int height, FlurryRng *rng)
+{
+    GLubyte *data;
+    float *level;
+    int i, x, y, size;
+
+    memset(r, 0, sizeof(Raster));
+    if (!(data = MakeTextureData(rng)))
+	return 0;
+    r->width = width;
+    r->height = height;
+    if (!(r->accum = calloc((size_t) width * height * 3, sizeof(float)))) {
+	free(data);
+	return 0;
+    }
+
+    /* what a texel adds: GL_MODULATE scales the colour by its luminance
+       and alpha by its alpha, and the blend multiplies the two */
+    for (i = 0, size = RASTER_TEXTURE; i < RASTER_LEVELS; i++, size >>= 1) {
+	if (!(level = r->level[i] = malloc(size * size * sizeof(float)))) {
+	    free(data);
+	    RasterFree(r);
+	    return 0;
+	}
+	for (y = 0; y < size; y++) {
+	    for (x = 0; x < size; x++) {
+		if (!i) {
+		    const GLubyte *t = &data[(y * size + x) * 2];
+
+		    level[y * size + x] = t[0] * t[1] / 65025.0f;
+		} else {
+		    const float *up = r->level[i - 1];
+		    int s = size * 2;
+
+		    level[y * size + x] = 0.25f *
+			(up[2*y*s + 2*x] + up[2*y*s + 2*x + 1] +
+			 up[(2*y+1)*s + 2*x] + up[(2*y+1)*s + 2*x + 1]);
+		}
+	    }
+	}
+    }
+    free(data);
+    return 1;
+}
+
+void RasterFree(Raster *r)
+{
+    int i;
+
+    free(r->accum);
+    for (i = 0; i < RASTER_LEVELS; i++)
+	free(r->level[i]);
+    memset(r, 0, sizeof(Raster));
+}
+
+static float RasterEdge(const float *a, const float *b, float px, float py)
+{
+    return (b[0] - a[0]) * (py - a[1]) - (b[1] - a[1]) * (px - a[0]);
+}
+
+/* pixels exactly on an edge go to the triangle on its left or top side,
+   so the two halves of a quad never both add to one */
+static int RasterOwns(const float *a, const float *b, float e)
+{
+    float dx = b[0] - a[0], dy = b[1] - a[1];
+
+    return e > 0.0f || (e == 0.0f && (dy < 0.0f || (dy == 0.0f && dx < 0.0f)));
+}
+
+static void RasterTriangle(Raster *r, const float *a, const float *b, const float *c,
+			   const float *ta, const float *tb, const float *tc,
+			   const float *texels, int size, const float rgb[3])
+{
+    float area = RasterEdge(a, b, c[0], c[1]);
+    float minX, maxX, minY, maxY;
+    int x, y, x0, x1, y0, y1;
+
+    if (area == 0.0f)
+	return;
+    if (area < 0.0f) {
+	const float *t = b;
+
+	b = c;
+	c = t;
+	t = tb;
+	tb = tc;
+	tc = t;
+	area = -area;
+    }
+
+    minX = MIN_(a[0], MIN_(b[0], c[0]));
+    maxX = MAX_(a[0], MAX_(b[0], c[0]));
+    minY = MIN_(a[1], MIN_(b[1], c[1]));
+    maxY = MAX_(a[1], MAX_(b[1], c[1]));
+    x0 = MAX_(0, (int) floor(minX));
+    x1 = MIN_(r->width - 1, (int) ceil(maxX));
+    y0 = MAX_(0, (int) floor(minY));
+    y1 = MIN_(r->height - 1, (int) ceil(maxY));
+
+    for (y = y0; y <= y1; y++) {
+	float py = y + 0.5f;
+	float *out = &r->accum[((size_t) y * r->width + x0) * 3];
+
+	for (x = x0; x <= x1; x++, out += 3) {
+	    float px = x + 0.5f;
+	    float w0 = RasterEdge(b, c, px, py);
+	    float w1 = RasterEdge(c, a, px, py);
+	    float w2 = RasterEdge(a, b, px, py);
+	    float u, v, k;
+
+	    if (!RasterOwns(b, c, w0) || !RasterOwns(c, a, w1) || !RasterOwns(a, b, w2))
+		continue;
+	    u = (w0 * ta[0] + w1 * tb[0] + w2 * tc[0]) / area;
+	    v = (w0 * ta[1] + w1 * tb[1] + w2 * tc[1]) / area;
+	    /* GL_REPEAT: floor, not truncation, so u < 0 wraps too */
+	    k = texels[(((int) floorf(v * size)) & (size - 1)) * size +
+		       (((int) floorf(u * size)) & (size - 1))];
+	    out[0] += rgb[0] * k;
+	    out[1] += rgb[1] * k;
+	    out[2] += rgb[2] * k;
+	}
+    }
+}
+
+void RasterFrame(Raster *r, const SmokeStaging *st, int quads, float alpha)
+{
+    float keep = 1.0f - alpha;
+    size_t i, n = (size_t) r->width * r->height * 3;
+    int q, level;
+
+    for (i = 0; i < n; i++)
+	r->accum[i] *= keep;
+
+    for (q = 0; q < quads; q++) {
+	const float *v = st->seraphimVertices[q * 2].f;
+	const float *t = &st->seraphimTextures[q * 8];
+	const float *c = st->seraphimColors[q * 4].f;
+	float rgb[3], a, side, rho;
+
+	/* fixed function GL clamps vertex colours */
+	a = MAX_(0.0f, MIN_(1.0f, c[3]));
+	for (level = 0; level < 3; level++)
+	    rgb[level] = MAX_(0.0f, MIN_(1.0f, c[level])) * a;
+
+	/* texels per pixel across the narrower side */
+	side = MIN_(hypot(v[2] - v[0], v[3] - v[1]), hypot(v[4] - v[2], v[5] - v[3]));
+	rho = side > 0.0f ? RASTER_CELL / side : RASTER_CELL;
+	level = rho > 1.0f ? (int) (log(rho) / log(2.0) + 0.5) : 0;
+	level = MIN_(RASTER_LEVELS - 1, level);
+
+	RasterTriangle(r, &v[0], &v[2], &v[4], &t[0], &t[2], &t[4],
+		       r->level[level], RASTER_TEXTURE >> level, rgb);
+	RasterTriangle(r, &v[0], &v[4], &v[6], &t[0], &t[4], &t[6],
+		       r->level[level], RASTER_TEXTURE >> level, rgb);
+    }
+}
+
+void RasterResolve(const Raster *r, unsigned char *out, int stride)
+{
+    int x, y;
+
+    for (y = 0; y < r->height; y++) {
+	const float *in = &r->accum[(size_t) y * r->width * 3];
+	unsigned char *p = out + (size_t) (r->height - 1 - y) * stride;
+
+	for (x = 0; x < r->width; x++, in += 3, p += 4) {
+	    p[0] = (unsigned char) (MIN_(1.0f, in[2]) * 255.0f + 0.5f);
+	    p[1] = (unsigned char) (MIN_(1.0f, in[1]) * 255.0f + 0.5f);
+	    p[2] = (unsigned char) (MIN_(1.0f, in[0]) * 255.0f + 0.5f);
+	    p[3] = 255;
+	}
+    }
+}
@@ -0,0 +1,310 @@
+/*
+
+Copyright (c) 2002, Calum Robinson
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+* Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+/* Replay.c: record a session's frame clock, and replay it headless.
+
+   A fixed time step (flurry -bench) never sees what a real session
+   does: a compositor that holds a frame back, a throttled CPU, a timer
+   that fires late.  With -record the scene's starting point (preset,
+   size, settings, the generator state it was built from and the time
+   it was built at) goes into a file, followed by 24 bytes a frame: the
+   time SceneStep was given, the size it stepped at, the governor's
+   particle cap at that step and how many particles were left alive.
+   The size is there for the window being resized mid-session, which
+   changes what gets culled.
+
+   flurry -replay rebuilds the scene from that and steps it through the
+   same times, with whichever kernel or -field grid is asked for, as
+   fast as it can, and reports the work per frame.  Since the simulation
+   only ever sees those times and its own generators, a bit exact kernel
+   reproduces the recorded session particle for particle; the live
+   counts are checked as it goes, and the first frame they differ on is
+   reported. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <flurry.h>
+
+#define RECORD_MAGIC   0x52524c46 /* "FLRR" */
+#define RECORD_VERSION 2
+
+typedef struct RecordHeader
+{
+    int magic;
+    int version;
+    int sizeRng;	/* a layout guard */
+    int preset;
+    float width, height;
+    float substepRate;
+    float lodWidth;
+    int fieldGrid;
+    int accumulate;
+    int optMode;
+    double created;	/* the time the preset was built at */
+    FlurryRng seed;	/* the scene's generator, before that */
+} RecordHeader;
+
+typedef struct RecordFrame
+{
+    double now;
+    float width, height;	/* SceneResize's, at this step */
+    float quality;	/* the governor's, at this step */
+    int live;		/* after it */
+} RecordFrame;
+
+int recordEnabled = 0;
+
+static FILE *recordFile;
+static const char *recordPath;
+
+static void RecordClose(void)
+{
+    if (recordFile && fclose(recordFile))
+	perror(recordPath);
+    recordFile = NULL;
+}
+
+int RecordOpen(const char *path)
+{
+    if (!(recordFile = fopen(path, "wb"))) {
+	perror(path);
+	return 0;
+    }
+    recordPath = path;
+    recordEnabled = 1;
+    atexit(RecordClose);
+    return 1;
+}
+
+void RecordStart(const global_info_t *scene, int preset, const FlurryRng *seed,
+		 double created)
+{
+    RecordHeader h;
+
+    memset(&h, 0, sizeof(h));
+    h.magic = RECORD_MAGIC;
+    h.version = RECORD_VERSION;
+    h.sizeRng = sizeof(FlurryRng);
+    h.preset = preset;
+    h.width = scene->sys_glWidth;
+    h.height = scene->sys_glHeight;
+    h.substepRate = scene->substepRate;
+    h.lodWidth = scene->lodWidth;
+    h.fieldGrid = scene->fieldGrid;
+    h.accumulate = scene->accumulate;
+    h.optMode = scene->optMode;
+    h.created = created;
+    h.seed = *seed;
+    if (fwrite(&h, sizeof(h), 1, recordFile) != 1) {
+	perror(recordPath);
+	recordEnabled = 0;
+    }
+}
+
+void RecordStep(double now, float width, float height, float quality, int live)
+{
+    RecordFrame f;
+
+    f.now = now;
+    f.width = width;
+    f.height = height;
+    f.quality = quality;
+    f.live = live;
+    if (fwrite(&f, sizeof(f), 1, recordFile) != 1) {
+	perror(recordPath);
+	recordEnabled = 0;
+    }
+}
+
+static int compareDouble(const void *a, const void *b)
+{
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+static int ReplayUsage(void)
+{
+    fprintf(stderr,
+	    "usage: flurry -replay file.rec [-mode name] [-field n] [-frames n]\n"
+	    "                      [-fused] [-o frames.csv]\n"
+	    "  -mode      kernel to replay with; the recorded one by default\n"
+	    "  -field     spark field grid, within 5%% RMS of the exact pull and\n"
+	    "             run where it beats the kernel; 0 for the exact pull,\n"
+	    "             recorded by default\n"
+	    "  -fused     update and draw the smoke in one pass\n"
+	    "  -o         one row per frame: time, step, work and live counts\n");
+    return 2;
+}
+
+int ReplayMain(int argc, char **argv)
+{
+    RecordHeader h;
+    RecordFrame f;
+    global_info_t *scene;
+    flurry_info_t *flurry;
+    SceneFrame frame;
+    FILE *in, *out = NULL;
+    const char *path = NULL, *csv = NULL;
+    double *work, sum = 0.0, first = 0.0, last = 0.0, t0, t1;
+    float quality = 1.0f;
+    int i, mode = -1, field = -1, frames = 0, maxFrames = -1, live, diverged = -1;
+    int fused = 0;
+    int room = 4096;
+
+    for (i = 1; i < argc; i++) {
+	if (!strcmp(argv[i], "-mode") && i + 1 < argc) {
+	    if ((mode = ParseOptMode(argv[++i])) < 0 || !OptModeSupported(mode))
+		return ReplayUsage();
+	} else if (!strcmp(argv[i], "-field") && i + 1 < argc) {
+	    field = atoi(argv[++i]);
+	    if (field != 0 && !FieldGridValid(field))
+		return ReplayUsage();
+	} else if (!strcmp(argv[i], "-frames") && i + 1 < argc) {
+	    maxFrames = atoi(argv[++i]);
+	} else if (!strcmp(argv[i], "-fused")) {
+	    fused = 1;
+	} else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+	    csv = argv[++i];
+	} else if (argv[i][0] != '-' && !path) {
+	    path = argv[i];
+	} else {
+	    return ReplayUsage();
+	}
+    }
+    if (!path)
+	return ReplayUsage();
+
+    if (!(in = fopen(path, "rb"))) {
+	perror(path);
+	return 2;
+    }
+    if (fread(&h, sizeof(h), 1, in) != 1 || h.magic != RECORD_MAGIC ||
+	h.version != RECORD_VERSION || h.sizeRng != sizeof(FlurryRng) ||
+	h.preset < PRESET_INSANE || h.preset >= PRESET_MAX ||
+	(h.fieldGrid != 0 && !FieldGridValid(h.fieldGrid))) {
+	fprintf(stderr, "%s: not a flurry recording\n", path);
+	fclose(in);
+	return 2;
+    }
+
+    if (!(scene = SceneCreate(PRESET_UNKNOWN, h.width, h.height, 0, 0.0))) {
+	fclose(in);
+	return 1;
+    }
+    scene->rng = h.seed;
+    scene->substepRate = h.substepRate;
+    scene->lodWidth = h.lodWidth;
+    scene->fieldGrid = field >= 0 ? field : h.fieldGrid;
+    scene->accumulate = h.accumulate;
+    scene->fusedSmoke = fused;
+    if (mode >= 0)
+	scene->optMode = mode;
+    else if (h.optMode >= 0 && h.optMode < OPT_MODE_MAX && OptModeSupported(h.optMode))
+	scene->optMode = h.optMode;
+    /* time the field before the clock starts */
+    FieldFrom(scene->fieldGrid, scene->optMode);
+    if (!CreatePreset(scene, h.preset, h.created) || !SceneFrameInit(&frame, scene) ||
+	!(work = malloc(room * sizeof(double)))) {
+	SceneDestroy(scene);
+	fclose(in);
+	return 1;
+    }
+
+    if (csv && !(out = fopen(csv, "w")))
+	perror(csv);
+    if (out)
+	fprintf(out, "frame,now,dt,work_ms,live,recorded_live\n");
+
+    while ((maxFrames < 0 || frames < maxFrames) && fread(&f, sizeof(f), 1, in) == 1) {
+	/* the window, as reshape_flurry left it */
+	if (f.width > 0.0f && f.height > 0.0f &&
+	    (f.width != scene->sys_glWidth || f.height != scene->sys_glHeight))
+	    SceneResize(scene, f.width, f.height);
+	/* the governor's cap, as GovernorApply set it */
+	if (f.quality != quality) {
+	    quality = f.quality;
+	    for (flurry = scene->flurry; flurry; flurry = flurry->next)
+		SetSmokeCap(flurry->s, (int) (quality * (NUMSMOKEPARTICLES/4)));
+	}
+
+	t0 = ProfileClock();
+	SceneStepBuild(scene, f.now, &frame);
+	t1 = ProfileClock() - t0;
+
+	for (i = 0, live = 0; i < frame.numFlurries; i++)
+	    live += frame.live[i];
+	if (live != f.live && diverged < 0)
+	    diverged = frames;
+
+	if (frames == room) {
+	    double *more = realloc(work, 2 * room * sizeof(double));
+
+	    if (!more)
+		break;
+	    work = more;
+	    room *= 2;
+	}
+	if (!frames)
+	    first = f.now;
+	last = f.now;
+	work[frames++] = t1;
+	sum += t1;
+	if (out)
+	    fprintf(out, "%d,%.6f,%.6f,%.4f,%d,%d\n", frames - 1, f.now,
+		    scene->frameDelta, t1 * 1000.0, live, f.live);
+    }
+    fclose(in);
+    if (out && fclose(out))
+	perror(csv);
+
+    if (frames) {
+	qsort(work, frames, sizeof(double), compareDouble);
+#define PCT(p) (work[(frames - 1) * (p) / 100] * 1000.0)
+	printf("preset,kernel,field,frames,seconds,mean_ms,p50_ms,p90_ms,p99_ms,max_ms,diverged_at\n");
+	printf("%s,%s,%d,%d,%.3f,%.4f,%.4f,%.4f,%.4f,%.4f,", PresetName(h.preset),
+	       OptModeName(scene->optMode), scene->fieldGrid, frames,
+	       last - first, sum * 1000.0 / frames, PCT(50), PCT(90), PCT(99),
+	       work[frames - 1] * 1000.0);
+#undef PCT
+	if (diverged >= 0)
+	    printf("%d\n", diverged);
+	else
+	    printf("\n");
+    }
+
+    free(work);
+    SceneFrameFree(&frame);
+    SceneDestroy(scene);
+    return frames ? 0 : 1;
+}
@@ -0,0 +1,477 @@
+/*
+
+Copyright (c) 2002, Calum Robinson
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+* Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/* Scene.c: libflurry, the simulation without the window.
+
+   Everything a scene needs lives in its global_info_t and its flurries'
+   arena blocks: the flurries, a generator each, and the time of the last
+   step, which is whatever the caller said it was.  So one process can
+   run any number of scenes, and run them on any threads, without them
+   seeing each other.  What is still process-wide is either read-only
+   once set up (the kernel selection, the arena options) or only meant
+   for a program running one scene (the profiler's statistics). */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <flurry.h>
+
+__thread FlurryRng *flurryRng;
+
+/* glibc's srandom() for a TYPE_3 state, to the same sequence */
+void RngSeed(FlurryRng *rng, unsigned int seed)
+{
+    int word, hi, lo, i;
+
+    word = seed ? (int) seed : 1;
+    rng->r[0] = word;
+    for (i = 1; i < 31; i++) {
+	hi = word / 127773;
+	lo = word % 127773;
+	word = 16807 * lo - 2836 * hi;
+	if (word < 0)
+	    word += 2147483647;
+	rng->r[i] = word;
+    }
+    rng->f = 3;
+    rng->b = 0;
+    for (i = 0; i < 310; i++)
+	RngNext(rng);
+}
+
+FlurryRng *RngBind(FlurryRng *rng)
+{
+    FlurryRng *old = flurryRng;
+
+    flurryRng = rng;
+    return old;
+}
+
+void delete_flurry_info(flurry_info_t *flurry)
+{
+    FlurryBlockFree(flurry);
+}
+
+flurry_info_t *new_flurry_info(global_info_t *global, int streams, ColorModes colour, float thickness, float speed, double bf, double now)
+{
+    int i,k;
+    flurry_info_t *flurry = FlurryBlockAlloc(streams);
+    FlurryRng *home;
+
+    if (!flurry) return NULL;
+
+    /* set up from the scene's generator, then go our own way */
+    home = RngBind(&global->rng);
+    flurry->flurryRandomSeed = RandFlt(0.0, 300.0);
+
+	flurry->fOldTime = 0;
+	flurry->fTime = now + flurry->flurryRandomSeed;
+ 	flurry->fDeltaTime = flurry->fTime - flurry->fOldTime;
+	flurry->dframe = 0;
+
+    flurry->streamExpansion = thickness;
+    flurry->currentColorMode = colour;
+    flurry->briteFactor = bf;
+
+    InitSmoke(flurry->s);
+
+    InitStar(flurry->star);
+    flurry->star->rotSpeed = speed;
+
+    for (i = 0;i < streams; i++)
+    {
+	InitSpark(&flurry->spark[i]);
+	flurry->spark[i].mystery = 1800 * (i + 1) / 13; /* 100 * (i + 1) / (flurry->numStreams + 1); */
+    }
+    UpdateSparks(global, flurry, streams);
+    RngSeed(&flurry->rng, RngNext(&global->rng));
+    RngBind(home);
+
+    for (i=0;i<NUMSMOKEPARTICLES/4;i++) {
+	for(k=0;k<4;k++) {
+	    SmokeSetDead(flurry->s, i, k, 1);
+	}
+    }
+
+    flurry->next = NULL;
+
+    return flurry;
+}
+
+/* with st, the smoke is drawn into it as it is updated */
+static int SubStepFlurry(global_info_t *global, flurry_info_t *flurry, double fTime,
+			 SmokeStaging *st, float brightness)
+{
+    double t;
+    int quads = 0;
+
+    flurry->dframe++;
+
+    flurry->fOldTime = flurry->fTime;
+    flurry->fTime = fTime;
+    flurry->fDeltaTime = flurry->fTime - flurry->fOldTime;
+
+    flurry->drag = (float) pow(0.9965,flurry->fDeltaTime*85.0);
+
+    PROFILE_BEGIN(PHASE_STAR, t);
+    UpdateStar(global, flurry, flurry->star);
+    PROFILE_END(PHASE_STAR, t);
+
+    PROFILE_BEGIN(PHASE_SPARK, t);
+    UpdateSparks(global, flurry, flurry->numStreams);
+    PROFILE_END(PHASE_SPARK, t);
+
+    PROFILE_BEGIN(PHASE_SMOKE, t);
+    if (st)
+	quads = UpdateDrawSmoke(global, flurry, flurry->s, st, brightness);
+    else
+	UpdateSmoke(global, flurry, flurry->s);
+    PROFILE_END(PHASE_SMOKE, t);
+    return quads;
+}
+
+/*
+ * A long frame is cut into sub-steps of at most 1/substepRate seconds,
+ * each a full star, spark and smoke update.  Emission can then fire in
+ * every sub-step, from where the star was at that moment, and no Euler
+ * step is longer than the bound, so a slow machine keeps dense streams
+ * and particles that orbit the sparks instead of flying past them.
+ * dframe counts sub-steps, which keeps the frameRateModifier in the
+ * smoke update in step with the real step length.
+ */
+int StepDrawFlurry(global_info_t *global, flurry_info_t *flurry, double now,
+		   SmokeStaging *st, float brightness)
+{
+    double from = flurry->fTime;
+    double to = now + flurry->flurryRandomSeed;
+    FlurryRng *home = RngBind(&flurry->rng);
+    int i, n = 1, quads;
+
+    if (global->substepRate > 0.0f && (to - from) * global->substepRate > 1.0)
+	n = MIN_(MAX_SUBSTEPS, (int) ceil((to - from) * global->substepRate));
+
+    for (i = 1; i < n; i++)
+	SubStepFlurry(global, flurry, from + (to - from) * i / n, NULL, 0.0f);
+    quads = SubStepFlurry(global, flurry, to, st, brightness);
+    RngBind(home);
+    return quads;
+}
+
+void StepFlurry(global_info_t *global, flurry_info_t *flurry, double now)
+{
+    StepDrawFlurry(global, flurry, now, NULL, 0.0f);
+}
+
+int ParsePreset(const char *name)
+{
+    if (!strcmp(name, "random")) {
+        return random() % PRESET_MAX;
+    } else if (!strcmp(name, "water")) {
+        return PRESET_WATER;
+    } else if (!strcmp(name, "fire")) {
+        return PRESET_FIRE;
+    } else if (!strcmp(name, "psychedelic")) {
+        return PRESET_PSYCHEDELIC;
+    } else if (!strcmp(name, "rgb")) {
+        return PRESET_RGB;
+    } else if (!strcmp(name, "binary")) {
+        return PRESET_BINARY;
+    } else if (!strcmp(name, "classic")) {
+        return PRESET_CLASSIC;
+    } else if (!strcmp(name, "insane")) {
+        return PRESET_INSANE;
+    }
+    return PRESET_UNKNOWN;
+}
+
+const char *PresetName(int preset)
+{
+    switch (preset) {
+    case PRESET_WATER:
+	return "water";
+    case PRESET_FIRE:
+	return "fire";
+    case PRESET_PSYCHEDELIC:
+	return "psychedelic";
+    case PRESET_RGB:
+	return "rgb";
+    case PRESET_BINARY:
+	return "binary";
+    case PRESET_CLASSIC:
+	return "classic";
+    case PRESET_INSANE:
+	return "insane";
+    default:
+	return "unknown";
+    }
+}
+
+static int add_flurry(global_info_t *global, int streams, ColorModes colour, float thickness, float speed, double bf, double now)
+{
+    flurry_info_t *flurry;
+
+    flurry = new_flurry_info(global, streams, colour, thickness, speed, bf, now);
+    if (!flurry)
+	return 0;
+    flurry->next = global->flurry;
+    global->flurry = flurry;
+    return 1;
+}
+
+static void FreeFlurries(global_info_t *global)
+{
+    flurry_info_t *flurry;
+
+    while ((flurry = global->flurry)) {
+	global->flurry = flurry->next;
+	delete_flurry_info(flurry);
+    }
+}
+
+int CreatePreset(global_info_t *global, int preset, double now)
+{
+    int i, ok = 1;
+
+    global->flurry = NULL;
+    global->preset = preset;
+
+    switch (preset) {
+    case PRESET_WATER: {
+	for (i = 0; i < 9; i++)
+	    ok &= add_flurry(global, 1, blueColorMode, 100.0, 2.0, 2.0, now);
+        break;
+    }
+    case PRESET_FIRE: {
+	ok &= add_flurry(global, 12, slowCyclicColorMode, 10000.0, 0.2, 1.0, now);
+        break;
+    }
+    case PRESET_PSYCHEDELIC: {
+	ok &= add_flurry(global, 10, rainbowColorMode, 200.0, 2.0, 1.0, now);
+        break;
+    }
+    case PRESET_RGB: {
+	ok &= add_flurry(global, 3, redColorMode, 100.0, 0.8, 1.0, now);
+	ok &= add_flurry(global, 3, greenColorMode, 100.0, 0.8, 1.0, now);
+	ok &= add_flurry(global, 3, blueColorMode, 100.0, 0.8, 1.0, now);
+        break;
+    }
+    case PRESET_BINARY: {
+	ok &= add_flurry(global, 16, tiedyeColorMode, 1000.0, 0.5, 1.0, now);
+	ok &= add_flurry(global, 16, tiedyeColorMode, 1000.0, 1.5, 1.0, now);
+        break;
+    }
+    case PRESET_CLASSIC: {
+	ok &= add_flurry(global, 5, tiedyeColorMode, 10000.0, 1.0, 1.0, now);
+        break;
+    }
+    case PRESET_INSANE: {
+	ok &= add_flurry(global, 64, tiedyeColorMode, 1000.0, 0.5, 0.5, now);
+        break;
+    }
+    default: {
+        ok = 0;
+    }
+    }
+    if (!ok)
+	FreeFlurries(global);
+    return ok;
+}
+
+global_info_t *SceneCreate(int preset, float width, float height,
+			   unsigned int seed, double now)
+{
+    global_info_t *scene;
+
+    if (!(scene = calloc(1, sizeof(global_info_t))))
+	return NULL;
+
+    scene->optMode = SelectOptMode();
+    scene->substepRate = DEF_SUBSTEP_RATE;
+    scene->sys_glWidth = width;
+    scene->sys_glHeight = height;
+    scene->preset = preset;
+    scene->lastStep = -1.0;
+    RngSeed(&scene->rng, seed);
+
+    if (preset != PRESET_UNKNOWN && !CreatePreset(scene, preset, now)) {
+	free(scene);
+	return NULL;
+    }
+    return scene;
+}
+
+void SceneResize(global_info_t *scene, float width, float height)
+{
+    scene->sys_glWidth = width;
+    scene->sys_glHeight = height;
+}
+
+/* the first step only sets the clock going */
+static void SceneClock(global_info_t *scene, double now)
+{
+    scene->frameDelta = scene->lastStep < 0.0 ? 0.0 : now - scene->lastStep;
+    scene->lastStep = now;
+}
+
+/* brighter and faster fading the longer the frame; the first frame
+   clears to black */
+static double SceneFade(global_info_t *scene, SceneFrame *frame)
+{
+    double brite;
+
+    if (scene->accumulate) {
+	brite = ACCUM_BRITE * scene->frameDelta;
+	frame->alpha = 1.0 - exp(-ACCUM_DECAY * scene->frameDelta);
+    } else {
+	brite = pow(scene->frameDelta, 0.75) * 10;
+	frame->alpha = MIN_(0.2, 5.0 * scene->frameDelta);
+    }
+    if (scene->frameDelta <= 0.0)
+	frame->alpha = 1.0;
+    return brite;
+}
+
+/* the rest of what a frame keeps of flurry n */
+static void SceneKeep(SceneFrame *frame, int n, flurry_info_t *flurry)
+{
+    frame->live[n] = flurry->s->live;
+#ifdef DRAW_SPARKS
+    memcpy(&frame->sparks[n * MAX_SPARKS], flurry->spark, flurry->numStreams * sizeof(Spark));
+#endif
+}
+
+void SceneStep(global_info_t *scene, double now)
+{
+    flurry_info_t *flurry;
+    int n;
+
+    SceneClock(scene, now);
+
+    for (flurry = scene->flurry, n = 0; flurry; flurry = flurry->next, n++) {
+	TraceBegin("step", n);
+	StepFlurry(scene, flurry, now);
+	TraceEnd("step", n);
+    }
+}
+
+int SceneBuild(global_info_t *scene, SceneFrame *frame)
+{
+    flurry_info_t *flurry;
+    SmokeStaging st;
+    double brite, t;
+    int n, quads = 0;
+
+    brite = SceneFade(scene, frame);
+
+    for (flurry = scene->flurry, n = 0; flurry && n < frame->numFlurries;
+	 flurry = flurry->next, n++) {
+	TraceBegin("build", n);
+	/* packed, so a renderer can draw the lot in one go */
+	SliceSmokeStaging(&st, &frame->staging, quads, NUMSMOKEPARTICLES);
+	PROFILE_BEGIN(PHASE_VERTS, t);
+	frame->quads[n] = DrawSmoke(scene, flurry, flurry->s, &st, brite * flurry->briteFactor);
+	PROFILE_END(PHASE_VERTS, t);
+	SceneKeep(frame, n, flurry);
+	quads += frame->quads[n];
+	TraceEnd("build", n);
+    }
+    frame->allQuads = quads;
+    return quads;
+}
+
+int SceneStepBuild(global_info_t *scene, double now, SceneFrame *frame)
+{
+    flurry_info_t *flurry;
+    SmokeStaging st;
+    double brite;
+    int n, quads = 0;
+
+    if (!scene->fusedSmoke) {
+	SceneStep(scene, now);
+	return SceneBuild(scene, frame);
+    }
+
+    SceneClock(scene, now);
+    brite = SceneFade(scene, frame);
+
+    for (flurry = scene->flurry, n = 0; flurry && n < frame->numFlurries;
+	 flurry = flurry->next, n++) {
+	TraceBegin("step", n);
+	SliceSmokeStaging(&st, &frame->staging, quads, NUMSMOKEPARTICLES);
+	frame->quads[n] = StepDrawFlurry(scene, flurry, now, &st, brite * flurry->briteFactor);
+	SceneKeep(frame, n, flurry);
+	quads += frame->quads[n];
+	TraceEnd("step", n);
+    }
+    /* a frame made before flurries were added has no room for them */
+    for (; flurry; flurry = flurry->next)
+	StepFlurry(scene, flurry, now);
+    frame->allQuads = quads;
+    return quads;
+}
+
+void SceneDestroy(global_info_t *scene)
+{
+    FreeFlurries(scene);
+    if (scene->staging) {
+	FreeSmokeStaging(scene->staging);
+	free(scene->staging);
+    }
+    free(scene);
+}
+
+int SceneFrameInit(SceneFrame *frame, const global_info_t *scene)
+{
+    flurry_info_t *flurry;
+
+    memset(frame, 0, sizeof(SceneFrame));
+    for (flurry = scene->flurry; flurry; flurry = flurry->next)
+	frame->numFlurries++;
+
+    if (!InitSmokeStaging(&frame->staging, frame->numFlurries * NUMSMOKEPARTICLES) ||
+	!(frame->quads = calloc(frame->numFlurries, sizeof(int))) ||
+	!(frame->live = calloc(frame->numFlurries, sizeof(int))) ||
+	!(frame->sparks = calloc(frame->numFlurries * MAX_SPARKS, sizeof(Spark)))) {
+	SceneFrameFree(frame);
+	return 0;
+    }
+    return 1;
+}
+
+void SceneFrameFree(SceneFrame *frame)
+{
+    FreeSmokeStaging(&frame->staging);
+    free(frame->quads);
+    free(frame->live);
+    free(frame->sparks);
+    memset(frame, 0, sizeof(SceneFrame));
+}
@@ -0,0 +1,267 @@
+/*
+
+Copyright (c) 2002, Calum Robinson
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+* Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+/* Sink.c: frames in a shared memory ring, for other processes to map.
+
+   With -sink the frames go into a ring of SinkSlots in one memfd, laid
+   out as flurry.h describes, and a consumer (a compositor, an encoder)
+   maps the same pages and reads them where they were drawn.  It gets
+   the descriptor by connecting to the Unix socket named: the sink
+   thread answers each connection with a read only descriptor of the
+   memfd, as SCM_RIGHTS, and closes it.  The memfd is sealed at its
+   size, so a mapping of it never faults past the end.
+
+   The writer never waits on a reader.  Each slot has a sequence count,
+   odd while the slot is being drawn into; the header's head counts the
+   frames published, and after each one the writer wakes whoever is in
+   FUTEX_WAIT on it.  A reader waits for head to move, takes the slot
+   frame head - 1 went into, and checks that slot's count is the same,
+   and even, before and after it has used the pixels; if not, it fell a
+   whole ring behind and that frame is gone.  With more slots a reader
+   has that much longer. */
+
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <linux/futex.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <flurry.h>
+
+int sinkEnabled = 0;
+
+static int sinkFd = -1;		/* the memfd */
+static int shareFd = -1;	/* what consumers get: read only */
+static int listenFd = -1;
+static SinkHeader *sink;
+static size_t sinkSize;
+static char socketPath[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+
+static SinkSlot *SinkSlotOf(unsigned int frame)
+{
+    return (SinkSlot *) ((char *) sink + sink->slotOffset +
+			 (size_t) (frame % sink->slots) * sink->slotSize);
+}
+
+static void SinkSend(int fd)
+{
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+    char byte = 'F';
+    union {
+	struct cmsghdr align;
+	char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &shareFd, sizeof(int));
+    sendmsg(fd, &msg, MSG_NOSIGNAL);
+}
+
+static void *SinkThread(void *arg)
+{
+    /* out of descriptors or memory: let the clients already in go first */
+    struct timespec backoff = { 0, 100000000 };
+    int fd;
+
+    (void) arg;
+    for (;;) {
+	if ((fd = accept(listenFd, NULL, NULL)) < 0) {
+	    switch (errno) {
+	    case EINTR:
+	    case ECONNABORTED:
+	    case EPROTO:
+		continue;
+	    case EMFILE:
+	    case ENFILE:
+	    case ENOBUFS:
+	    case ENOMEM:
+		nanosleep(&backoff, NULL);
+		continue;
+	    default:
+		perror("sink: accept");
+		return NULL;
+	    }
+	}
+	SinkSend(fd);
+	close(fd);
+    }
+    return NULL;
+}
+
+static void SinkUnlink(void)
+{
+    unlink(socketPath);
+}
+
+static int SinkListen(const char *path)
+{
+    struct sockaddr_un un;
+    struct stat st;
+    int fd;
+
+    if (strlen(path) >= sizeof(un.sun_path) ||
+	(fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+	return -1;
+    memset(&un, 0, sizeof(un));
+    un.sun_family = AF_UNIX;
+    strcpy(un.sun_path, path);
+    /* a socket left behind by an earlier run, but nothing else */
+    if (lstat(path, &st) == 0) {
+	if (!S_ISSOCK(st.st_mode)) {
+	    close(fd);
+	    errno = EEXIST;
+	    return -1;
+	}
+	unlink(path);
+    }
+    if (bind(fd, (struct sockaddr *) &un, sizeof(un)) < 0 || listen(fd, 4) < 0) {
+	close(fd);
+	return -1;
+    }
+    strcpy(socketPath, path);
+    atexit(SinkUnlink);
+    return fd;
+}
+
+static int SinkMap(int width, int height, int slots)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t stride = (size_t) width * 4;
+    size_t slotSize = (SINK_SLOT_HEADER + stride * height + page - 1) / page * page;
+    size_t offset = (sizeof(SinkHeader) + page - 1) / page * page;
+    char proc[32];
+
+    sinkSize = offset + slotSize * slots;
+    if (slotSize > UINT_MAX)
+	return 0;
+    if ((sinkFd = memfd_create("flurry-sink", MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0)
+	return 0;
+    if (ftruncate(sinkFd, sinkSize) < 0 ||
+	fcntl(sinkFd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0)
+	return 0;
+    sink = mmap(NULL, sinkSize, PROT_READ | PROT_WRITE, MAP_SHARED, sinkFd, 0);
+    if (sink == MAP_FAILED) {
+	sink = NULL;
+	return 0;
+    }
+
+    /* ftruncate left it all zero: every slot even and empty */
+    sink->magic = SINK_MAGIC;
+    sink->version = SINK_VERSION;
+    sink->width = width;
+    sink->height = height;
+    sink->stride = stride;
+    sink->slots = slots;
+    sink->slotSize = slotSize;
+    sink->slotOffset = offset;
+
+    /* the same file, opened again read only, so consumers can't write */
+    sprintf(proc, "/proc/self/fd/%d", sinkFd);
+    if ((shareFd = open(proc, O_RDONLY | O_CLOEXEC)) < 0)
+	shareFd = sinkFd;
+    return 1;
+}
+
+int SinkOpen(const char *path, int width, int height, int slots)
+{
+    pthread_t thread;
+    sigset_t all, old;
+    int ok;
+
+    if (!SinkMap(width, height, slots)) {
+	perror("-sink");
+	return 0;
+    }
+    if ((listenFd = SinkListen(path)) < 0) {
+	perror(path);
+	return 0;
+    }
+
+    /* signals are for the render loop */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    ok = !pthread_create(&thread, NULL, SinkThread, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (!ok) {
+	fprintf(stderr, "%s: can't start the sink thread\n", path);
+	close(listenFd);
+	return 0;
+    }
+    pthread_detach(thread);
+    sinkEnabled = 1;
+    return 1;
+}
+
+unsigned char *SinkBegin(int *stride)
+{
+    SinkSlot *slot = SinkSlotOf(sink->head);
+
+    slot->seq++;
+    __sync_synchronize();
+    *stride = sink->stride;
+    return (unsigned char *) slot + SINK_SLOT_HEADER;
+}
+
+void SinkPublish(double time)
+{
+    SinkSlot *slot = SinkSlotOf(sink->head);
+
+    slot->frame = sink->head;
+    slot->time = time;
+    __sync_synchronize();
+    slot->seq++;
+    __sync_synchronize();
+    sink->head++;
+    syscall(SYS_futex, &sink->head, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
@@ -0,0 +1,457 @@
+/*
+
+Copyright (c) 2002, Calum Robinson
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+* Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/* SmokeKernel.h: vectorised smoke update and vertex generation.
+
+   This file is included once per instruction set by flurry-smoke-vector.c,
+   which defines
+     KERNEL(name)       to give each instance its own function names,
+     KERNEL_GROUPS      the number of 4-particle groups per vector, and
+     KERNEL_SQRT(v)     optionally, a lane-wise single precision square root,
+     KERNEL_LEAVE()     optionally, what to do on the way out of a kernel,
+   and selects the ISA with #pragma GCC target before including it.
+
+   The arithmetic follows UpdateSmoke_ScalarBase and DrawSmoke_Scalar
+   operation for operation, including the steps the scalar code does in
+   double precision, so the results stay within a few ulp of the
+   reference (exact unless the target contracts to FMA). */
+
+#define KLANES (KERNEL_GROUPS * 4)
+#define KSTRIDE (sizeof(SmokeParticleV) / sizeof(floatToVector))
+#ifndef FLURRY_COMPACT
+#define KCSTRIDE (sizeof(SmokeColdV) / sizeof(floatToVector))
+#endif
+
+typedef float KERNEL(vsf) __attribute__((vector_size(KLANES * 4)));
+typedef int KERNEL(vsi) __attribute__((vector_size(KLANES * 4)));
+typedef double KERNEL(vdf) __attribute__((vector_size(KLANES * 8)));
+
+typedef union
+{
+    KERNEL(vsf) v;
+    float f[KLANES];
+} KERNEL(fu);
+
+typedef union
+{
+    KERNEL(vsi) v;
+    int i[KLANES];
+} KERNEL(iu);
+
+#define KBLEND(m, a, b) \
+    ((KERNEL(vsf)) (((KERNEL(vsi)) (a) & (m)) | ((KERNEL(vsi)) (b) & ~(m))))
+#define KTODOUBLE(v) __builtin_convertvector((v), KERNEL(vdf))
+#define KTOFLOAT(v) __builtin_convertvector((v), KERNEL(vsf))
+
+/* fetch one field of KERNEL_GROUPS consecutive particle groups; stride is
+   KSTRIDE for the hot half of a group and KCSTRIDE for the cold one */
+static inline __attribute__((always_inline))
+KERNEL(vsf) KERNEL(LoadF)(const floatToVector *x, int stride)
+{
+    KERNEL(fu) r;
+    int g;
+
+    for (g = 0; g < KERNEL_GROUPS; g++)
+	memcpy(&r.f[g * 4], x[g * stride].f, sizeof(x->f));
+    return r.v;
+}
+
+static inline __attribute__((always_inline))
+void KERNEL(StoreF)(floatToVector *x, int stride, KERNEL(vsf) v)
+{
+    KERNEL(fu) r;
+    int g;
+
+    r.v = v;
+    for (g = 0; g < KERNEL_GROUPS; g++)
+	memcpy(x[g * stride].f, &r.f[g * 4], sizeof(x->f));
+}
+
+static inline __attribute__((always_inline))
+KERNEL(vsi) KERNEL(LoadI)(const intToVector *x, int stride)
+{
+    KERNEL(iu) r;
+    int g;
+
+    for (g = 0; g < KERNEL_GROUPS; g++)
+	memcpy(&r.i[g * 4], x[g * stride].i, sizeof(x->i));
+    return r.v;
+}
+
+static inline __attribute__((always_inline))
+void KERNEL(StoreI)(intToVector *x, int stride, KERNEL(vsi) v)
+{
+    KERNEL(iu) r;
+    int g;
+
+    r.v = v;
+    for (g = 0; g < KERNEL_GROUPS; g++)
+	memcpy(x[g * stride].i, &r.i[g * 4], sizeof(x->i));
+}
+
+/* dead flags and birth times of the KERNEL_GROUPS groups from i on; the
+   compact layout packs these, so it goes lane by lane through the
+   accessors in flurry.h */
+static inline __attribute__((always_inline))
+KERNEL(vsi) KERNEL(LoadDead)(const SmokeV *s, int i)
+{
+#ifndef FLURRY_COMPACT
+    return KERNEL(LoadI)(&s->p[i].dead, KSTRIDE);
+#else
+    KERNEL(iu) r;
+    int l;
+
+    for (l = 0; l < KLANES; l++)
+	r.i[l] = SmokeDead(s, i + (l >> 2), l & 3);
+    return r.v;
+#endif
+}
+
+static inline __attribute__((always_inline))
+void KERNEL(StoreDead)(SmokeV *s, int i, KERNEL(vsi) v)
+{
+#ifndef FLURRY_COMPACT
+    KERNEL(StoreI)(&s->p[i].dead, KSTRIDE, v);
+#else
+    KERNEL(iu) r;
+    int l;
+
+    r.v = v;
+    for (l = 0; l < KLANES; l++)
+	SmokeSetDead(s, i + (l >> 2), l & 3, r.i[l]);
+#endif
+}
+
+static inline __attribute__((always_inline))
+KERNEL(vsf) KERNEL(LoadBirth)(const SmokeV *s, int i)
+{
+#ifndef FLURRY_COMPACT
+    return KERNEL(LoadF)(&s->c[i].time, KCSTRIDE);
+#else
+    KERNEL(fu) r;
+    int l;
+
+    for (l = 0; l < KLANES; l++)
+	r.f[l] = SmokeBirth(s, i + (l >> 2), l & 3);
+    return r.v;
+#endif
+}
+
+#ifndef KERNEL_SQRT
+static inline __attribute__((always_inline))
+KERNEL(vsf) KERNEL(Sqrt)(KERNEL(vsf) v)
+{
+    KERNEL(fu) r;
+    int l;
+
+    r.v = v;
+    for (l = 0; l < KLANES; l++)
+	r.f[l] = (float) sqrt(r.f[l]);
+    return r.v;
+}
+#define KERNEL_SQRT(v) KERNEL(Sqrt)(v)
+#endif
+
+static inline __attribute__((always_inline))
+int KERNEL(Any)(KERNEL(vsi) m)
+{
+    KERNEL(iu) r;
+    int l;
+
+    r.v = m;
+    for (l = 0; l < KLANES; l++)
+	if (r.i[l])
+	    return 1;
+    return 0;
+}
+
+/* groups [first, last), first a multiple of KERNEL_GROUPS */
+void KERNEL(UpdateSmokeRange)(global_info_t *global, flurry_info_t *flurry, SmokeV *s,
+			      int first, int last)
+{
+    float sparkX[MAX_BENCH_SPARKS], sparkY[MAX_BENCH_SPARKS], sparkZ[MAX_BENCH_SPARKS];
+    int numStreams = flurry->numStreams;
+    double frameRateModifier;
+    double dt = flurry->fDeltaTime;
+    float drag = flurry->drag;
+    int i, j, l;
+
+    (void) global;
+
+    frameRateModifier = 42.5f / (((double) flurry->dframe)/(flurry->fTime));
+
+    for (j = 0; j < numStreams; j++) {
+	sparkX[j] = flurry->spark[j].position[0];
+	sparkY[j] = flurry->spark[j].position[1];
+	sparkZ[j] = flurry->spark[j].position[2];
+    }
+
+    for (i = first; i < last; i += KERNEL_GROUPS) {
+	SmokeParticleV *p = &s->p[i];
+	KERNEL(vsi) dead, alive, kill;
+	KERNEL(vsf) px, py, pz, vx, vy, vz;
+	KERNEL(iu) own;
+
+	dead = KERNEL(LoadDead)(s, i);
+	alive = dead == 0;
+	if (!KERNEL(Any)(alive))
+	    continue;
+
+	px = KERNEL(LoadF)(&p->position[0], KSTRIDE);
+	py = KERNEL(LoadF)(&p->position[1], KSTRIDE);
+	pz = KERNEL(LoadF)(&p->position[2], KSTRIDE);
+	vx = KERNEL(LoadF)(&p->delta[0], KSTRIDE);
+	vy = KERNEL(LoadF)(&p->delta[1], KSTRIDE);
+	vz = KERNEL(LoadF)(&p->delta[2], KSTRIDE);
+
+	/* which stream each lane belongs to, for the streamBias term */
+	for (l = 0; l < KLANES; l++)
+	    own.i[l] = (i * 4 + l) % numStreams;
+
+	for (j = 0; j < numStreams; j++) {
+	    KERNEL(vsf) dx = px - sparkX[j];
+	    KERNEL(vsf) dy = py - sparkY[j];
+	    KERNEL(vsf) dz = pz - sparkZ[j];
+	    KERNEL(vsf) rsquared = dx*dx+dy*dy+dz*dz;
+	    KERNEL(vsf) f, mag;
+
+	    f = KTOFLOAT(KTODOUBLE(gravity/rsquared) * frameRateModifier);
+	    f = KBLEND(own.v == j, f * (1.0f + streamBias), f);
+	    mag = f / KERNEL_SQRT(rsquared);
+
+	    vx -= dx * mag;
+	    vy -= dy * mag;
+	    vz -= dz * mag;
+	}
+
+	vx *= drag;
+	vy *= drag;
+	vz *= drag;
+
+	kill = alive & ((vx*vx+vy*vy+vz*vz) >= 25000000.0f);
+	alive &= ~kill;
+	KERNEL(StoreDead)(s, i, dead | (kill & 1));
+
+	KERNEL(StoreF)(&p->delta[0], KSTRIDE, KBLEND(alive, vx, KERNEL(LoadF)(&p->delta[0], KSTRIDE)));
+	KERNEL(StoreF)(&p->delta[1], KSTRIDE, KBLEND(alive, vy, KERNEL(LoadF)(&p->delta[1], KSTRIDE)));
+	KERNEL(StoreF)(&p->delta[2], KSTRIDE, KBLEND(alive, vz, KERNEL(LoadF)(&p->delta[2], KSTRIDE)));
+
+	KERNEL(StoreF)(&p->oldposition[0], KSTRIDE, KBLEND(alive, px, KERNEL(LoadF)(&p->oldposition[0], KSTRIDE)));
+	KERNEL(StoreF)(&p->oldposition[1], KSTRIDE, KBLEND(alive, py, KERNEL(LoadF)(&p->oldposition[1], KSTRIDE)));
+	KERNEL(StoreF)(&p->oldposition[2], KSTRIDE, KBLEND(alive, pz, KERNEL(LoadF)(&p->oldposition[2], KSTRIDE)));
+
+	KERNEL(StoreF)(&p->position[0], KSTRIDE, KBLEND(alive, KTOFLOAT(KTODOUBLE(px) + KTODOUBLE(vx) * dt), px));
+	KERNEL(StoreF)(&p->position[1], KSTRIDE, KBLEND(alive, KTOFLOAT(KTODOUBLE(py) + KTODOUBLE(vy) * dt), py));
+	KERNEL(StoreF)(&p->position[2], KSTRIDE, KBLEND(alive, KTOFLOAT(KTODOUBLE(pz) + KTODOUBLE(vz) * dt), pz));
+    }
+#ifdef KERNEL_LEAVE
+    KERNEL_LEAVE();
+#endif
+}
+
+void KERNEL(UpdateSmoke)(global_info_t *global, flurry_info_t *flurry, SmokeV *s)
+{
+    EmitSmoke(flurry, s);
+    KERNEL(UpdateSmokeRange)(global, flurry, s, 0, s->numGroups);
+}
+
+/* Projection, expiry and culling are done a vector at a time; the quads
+   for the surviving lanes are then written out one by one.  first is a
+   multiple of KERNEL_GROUPS. */
+int KERNEL(DrawSmokeRange)(global_info_t *global, flurry_info_t *flurry, SmokeV *s, SmokeStaging *st,
+			   float brightness, int first, int last, int *live)
+{
+    int svi = 0;
+    int sci = 0;
+    int sti = 0;
+    int si = 0;
+    int count = 0;
+    float glWidth = global->sys_glWidth;
+    float glHeight = global->sys_glHeight;
+    float screenRatio = glWidth / 1024.0f;
+    float hslash2 = glHeight * 0.5f;
+    float wslash2 = glWidth * 0.5f;
+    float width = (streamSize+2.5f*flurry->streamExpansion) * screenRatio;
+    float lodWidth = global->lodWidth;
+    double fTime = flurry->fTime;
+    double expansion = flurry->streamExpansion;
+    const KERNEL(vsf) zero = { 0.0f };
+    int i, l, ii, jj;
+
+    for (i = first; i < last; i += KERNEL_GROUPS) {
+	SmokeParticleV *p = &s->p[i];
+	KERNEL(vsi) dead, alive, expired, visible;
+	KERNEL(vsf) thisWidth, z, oldz, sx, sy, osx, osy, w, ow, cmBase;
+	KERNEL(fu) vw, vow, vsx, vsy, vosx, vosy, vcm, vlod;
+	KERNEL(iu) vis;
+
+	dead = KERNEL(LoadDead)(s, i);
+	alive = dead == 0;
+	if (!KERNEL(Any)(alive))
+	    continue;
+
+	thisWidth = KTOFLOAT((streamSize + (fTime - KTODOUBLE(KERNEL(LoadBirth)(s, i))) * expansion) * screenRatio);
+	expired = alive & (thisWidth >= width);
+	alive &= ~expired;
+	KERNEL(StoreDead)(s, i, dead | (expired & 1));
+
+	z = KERNEL(LoadF)(&p->position[2], KSTRIDE);
+	oldz = KERNEL(LoadF)(&p->oldposition[2], KSTRIDE);
+	sx = KERNEL(LoadF)(&p->position[0], KSTRIDE) * glWidth / z + wslash2;
+	sy = KERNEL(LoadF)(&p->position[1], KSTRIDE) * glWidth / z + hslash2;
+	osx = (KERNEL(LoadF)(&p->oldposition[0], KSTRIDE) * glWidth / oldz) + wslash2;
+	osy = (KERNEL(LoadF)(&p->oldposition[1], KSTRIDE) * glWidth / oldz) + hslash2;
+
+	visible = alive & ~((sx > glWidth+50.0f) | (sx < -50.0f) |
+			    (sy > glHeight+50.0f) | (sy < -50.0f) |
+			    (z < 25.0f) | (oldz < 25.0f));
+
+	w = thisWidth / z;
+	vlod.v = thisWidth / (lodWidth * z);
+	w = KBLEND(1.0f > w, zero + 1.0f, w);
+	ow = thisWidth / oldz;
+	ow = KBLEND(1.0f > ow, zero + 1.0f, ow);
+	cmBase = 1.375f - thisWidth / width;
+
+	vis.v = alive;
+	for (l = 0; l < KLANES; l++)
+	    count += vis.i[l] != 0;
+
+	vis.v = visible;
+	vsx.v = sx; vsy.v = sy; vosx.v = osx; vosy.v = osy;
+	vw.v = w; vow.v = ow; vcm.v = cmBase;
+
+	for (l = 0; l < KLANES; l++) {
+	    int g = i + (l >> 2);
+	    int k = l & 3;
+	    int frame;
+	    float dx, dy, d, sm, os, m, cm;
+	    float dxs, dys, dxos, dyos, dxm, dym;
+	    float u0, v0, u1, v1;
+	    float lodGain = 1.0f;
+	    floatToVector cmv;
+
+	    if (!vis.i[l])
+		continue;
+
+	    if (vlod.f[l] < 1.0f) {
+		float keep = MAX_(LOD_MIN_KEEP, vlod.f[l]);
+
+		if (SmokeLodRand(g * 4 + k, SmokeBirth(s, g, k)) >= keep)
+		    continue;
+		lodGain = 1.0f / keep;
+	    }
+
+	    dx = vsx.f[l] - vosx.f[l];
+	    dy = vsy.f[l] - vosy.f[l];
+	    d = hypot(dx, dy);
+	    sm = d ? vw.f[l]/d : 0.0f;
+	    os = d ? vow.f[l]/d : 0.0f;
+	    m = 1.0f + sm;
+
+	    dxs = dx*sm;
+	    dys = dy*sm;
+	    dxos = dx*os;
+	    dyos = dy*os;
+	    dxm = dx*m;
+	    dym = dy*m;
+
+	    frame = SmokeFrame(s, g, k) + 1;
+	    if (frame >= 64)
+		frame = 0;
+	    SmokeSetFrame(s, g, k, frame);
+
+	    u0 = (frame& 7) * 0.125f;
+	    v0 = (frame>>3) * 0.125f;
+	    u1 = u0 + 0.125f;
+	    v1 = v0 + 0.125f;
+	    cm = vcm.f[l];
+	    si++;
+	    cm *= brightness * lodGain;
+	    cmv.f[0] = SmokeColor(s, g, 0, k)*cm;
+	    cmv.f[1] = SmokeColor(s, g, 1, k)*cm;
+	    cmv.f[2] = SmokeColor(s, g, 2, k)*cm;
+	    cmv.f[3] = SmokeColor(s, g, 3, k)*cm;
+
+	    for (jj = 0; jj < 4; jj++) {
+		for (ii = 0; ii < 4; ii++)
+		    st->seraphimColors[sci].f[ii] = cmv.f[ii];
+		sci += 1;
+	    }
+
+	    st->seraphimTextures[sti++] = u0;
+	    st->seraphimTextures[sti++] = v0;
+	    st->seraphimTextures[sti++] = u0;
+	    st->seraphimTextures[sti++] = v1;
+
+	    st->seraphimTextures[sti++] = u1;
+	    st->seraphimTextures[sti++] = v1;
+	    st->seraphimTextures[sti++] = u1;
+	    st->seraphimTextures[sti++] = v0;
+
+	    st->seraphimVertices[svi].f[0] = vsx.f[l]+dxm-dys;
+	    st->seraphimVertices[svi].f[1] = vsy.f[l]+dym+dxs;
+	    st->seraphimVertices[svi].f[2] = vsx.f[l]+dxm+dys;
+	    st->seraphimVertices[svi].f[3] = vsy.f[l]+dym-dxs;
+	    svi++;
+
+	    st->seraphimVertices[svi].f[0] = vosx.f[l]-dxm+dyos;
+	    st->seraphimVertices[svi].f[1] = vosy.f[l]-dym-dxos;
+	    st->seraphimVertices[svi].f[2] = vosx.f[l]-dxm-dyos;
+	    st->seraphimVertices[svi].f[3] = vosy.f[l]-dym+dxos;
+	    svi++;
+	}
+    }
+    *live += count;
+#ifdef KERNEL_LEAVE
+    KERNEL_LEAVE();
+#endif
+    return si;
+}
+
+int KERNEL(DrawSmoke)(global_info_t *global, flurry_info_t *flurry, SmokeV *s, SmokeStaging *st, float brightness)
+{
+    int live = 0;
+    int si = KERNEL(DrawSmokeRange)(global, flurry, s, st, brightness, 0, s->numGroups, &live);
+
+    s->live = live;
+    return si;
+}
+
+#undef KBLEND
+#undef KTODOUBLE
+#undef KTOFLOAT
+#ifdef KCSTRIDE
+#undef KCSTRIDE
+#endif
+#undef KSTRIDE
+#undef KLANES
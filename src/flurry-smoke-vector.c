@@ -0,0 +1,90 @@
+/*
+
+Copyright (c) 2002, Calum Robinson
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+* Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/* SmokeVector.c: instruction set specific builds of the smoke kernels.
+   SelectOptMode (flurry-cpu.c) decides which one each flurry runs. */
+
+#include <string.h>
+
+#include <flurry.h>
+
+#if defined(__SSE__)
+#include <immintrin.h>
+#endif
+
+/* baseline: whatever the compiler targets by default (SSE2 on x86-64) */
+#define KERNEL(name) name##_Vector
+#define KERNEL_GROUPS 1
+#if defined(__SSE__)
+#define KERNEL_SQRT(v) ((vsf_Vector) _mm_sqrt_ps((__m128) (v)))
+#endif
+#include "flurry-smoke-kernel.h"
+#undef KERNEL_SQRT
+#undef KERNEL_GROUPS
+#undef KERNEL
+
+#ifdef FLURRY_X86_KERNELS
+
+/* plain AVX2, without FMA, so there is nothing to contract.  The wide
+   kernels clear the upper halves of the registers on the way out, or
+   the SSE code after them (the sparks, libm) pays for the transition. */
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#define KERNEL(name) name##_VectorAVX2
+#define KERNEL_GROUPS 2
+#define KERNEL_SQRT(v) ((vsf_VectorAVX2) _mm256_sqrt_ps((__m256) (v)))
+#define KERNEL_LEAVE() _mm256_zeroupper()
+#include "flurry-smoke-kernel.h"
+#undef KERNEL_LEAVE
+#undef KERNEL_SQRT
+#undef KERNEL_GROUPS
+#undef KERNEL
+#pragma GCC pop_options
+
+/* AVX-512F brings FMA with it.  No contraction: it would move the wide
+   kernels away from the scalar reference for no measurable gain in these
+   divide-bound loops. */
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+#pragma GCC optimize("fp-contract=off")
+#define KERNEL(name) name##_VectorAVX512
+#define KERNEL_GROUPS 4
+#define KERNEL_SQRT(v) ((vsf_VectorAVX512) _mm512_sqrt_ps((__m512) (v)))
+#define KERNEL_LEAVE() _mm256_zeroupper()
+#include "flurry-smoke-kernel.h"
+#undef KERNEL_LEAVE
+#undef KERNEL_SQRT
+#undef KERNEL_GROUPS
+#undef KERNEL
+#pragma GCC pop_options
+
+#endif /* FLURRY_X86_KERNELS */
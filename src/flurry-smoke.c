@@ -39,11 +39,16 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #define intensity 75000.0f;
 
+/* groups updated and then drawn at a time by UpdateDrawSmoke: a few KB
+   of particles and their quads, well inside L1 */
+#define FUSED_GROUPS 16
+
 void InitSmoke(SmokeV *s)
 {
     int i;
     s->nextParticle = 0;
     s->nextSubParticle = 0;
+    s->numGroups = NUMSMOKEPARTICLES/4;
     s->lastParticleTime = 0.25f;
     s->firstTime = 1;
     s->frame = 0;
@@ -52,18 +57,183 @@ void InitSmoke(SmokeV *s)
     }
 }
 
-void UpdateSmoke_ScalarBase(global_info_t *global, flurry_info_t *flurry, SmokeV *s)
+/* the kernel for this flurry */
+static int SmokeKernel(const global_info_t *global, const flurry_info_t *flurry)
 {
-    int i,j,k;
+    if (global->optMode == OPT_MODE_AUTO)
+	return OptModeForStreams(flurry->numStreams);
+    return global->optMode;
+}
+
+void UpdateSmoke(global_info_t *global, flurry_info_t *flurry, SmokeV *s)
+{
+    if (global->fieldGrid > 0 && UpdateSmoke_Field(global, flurry, s))
+	return;
+
+    switch(SmokeKernel(global, flurry)) {
+	case OPT_MODE_SCALAR_BASE:
+	    UpdateSmoke_ScalarBase(global, flurry, s);
+	    break;
+
+	case OPT_MODE_VECTOR:
+	    UpdateSmoke_Vector(global, flurry, s);
+	    break;
+
+#ifdef FLURRY_X86_KERNELS
+	case OPT_MODE_VECTOR_AVX2:
+	    UpdateSmoke_VectorAVX2(global, flurry, s);
+	    break;
+
+	case OPT_MODE_VECTOR_AVX512:
+	    UpdateSmoke_VectorAVX512(global, flurry, s);
+	    break;
+#endif
+
+	default:
+	    break;
+    }
+}
+
+static void UpdateSmokeRange(global_info_t *global, flurry_info_t *flurry, SmokeV *s,
+			     int first, int last)
+{
+    switch(SmokeKernel(global, flurry)) {
+	case OPT_MODE_SCALAR_BASE:
+	    UpdateSmokeRange_Scalar(global, flurry, s, first, last);
+	    break;
+
+	case OPT_MODE_VECTOR:
+	    UpdateSmokeRange_Vector(global, flurry, s, first, last);
+	    break;
+
+#ifdef FLURRY_X86_KERNELS
+	case OPT_MODE_VECTOR_AVX2:
+	    UpdateSmokeRange_VectorAVX2(global, flurry, s, first, last);
+	    break;
+
+	case OPT_MODE_VECTOR_AVX512:
+	    UpdateSmokeRange_VectorAVX512(global, flurry, s, first, last);
+	    break;
+#endif
+
+	default:
+	    break;
+    }
+}
+
+/* UpdateSmoke then DrawSmoke, a few groups at a time: each block is drawn
+   straight after it is moved, from L1, instead of the whole array going
+   through the cache twice.  Every particle's update and draw only touch
+   that particle, so the result is the same as the two passes. */
+int UpdateDrawSmoke(global_info_t *global, flurry_info_t *flurry, SmokeV *s, SmokeStaging *st, float brightness)
+{
+    SmokeStaging slice;
+    int i, last, quads = 0, live = 0;
+
+    /* the field's pull is sampled with every particle still in place,
+       and -prep draws the whole flurry at once */
+    if (FieldPays(global, flurry) || prepThreads > 1) {
+	UpdateSmoke(global, flurry, s);
+	return DrawSmoke(global, flurry, s, st, brightness);
+    }
+
+    EmitSmoke(flurry, s);
+    for (i = 0; i < s->numGroups; i = last) {
+	last = MIN_(s->numGroups, i + FUSED_GROUPS);
+	UpdateSmokeRange(global, flurry, s, i, last);
+	SliceSmokeStaging(&slice, st, quads, (last - i) * 4);
+	quads += DrawSmokeRange(global, flurry, s, &slice, brightness, i, last, &live);
+    }
+    s->live = live;
+    return quads;
+}
+
+int DrawSmoke(global_info_t *global, flurry_info_t *flurry, SmokeV *s, SmokeStaging *st, float brightness)
+{
+    int live = 0, quads;
+
+    if (prepThreads > 1 && (quads = DrawSmoke_Parallel(global, flurry, s, st, brightness)) >= 0)
+	return quads;
+    quads = DrawSmokeRange(global, flurry, s, st, brightness, 0, s->numGroups, &live);
+    s->live = live;
+    return quads;
+}
+
+int DrawSmokeRange(global_info_t *global, flurry_info_t *flurry, SmokeV *s, SmokeStaging *st,
+		   float brightness, int first, int last, int *live)
+{
+    switch(SmokeKernel(global, flurry)) {
+	case OPT_MODE_SCALAR_BASE:
+	    return DrawSmokeRange_Scalar(global, flurry, s, st, brightness, first, last, live);
+
+	case OPT_MODE_VECTOR:
+	    return DrawSmokeRange_Vector(global, flurry, s, st, brightness, first, last, live);
+
+#ifdef FLURRY_X86_KERNELS
+	case OPT_MODE_VECTOR_AVX2:
+	    return DrawSmokeRange_VectorAVX2(global, flurry, s, st, brightness, first, last, live);
+
+	case OPT_MODE_VECTOR_AVX512:
+	    return DrawSmokeRange_VectorAVX512(global, flurry, s, st, brightness, first, last, live);
+#endif
+
+	default:
+	    return 0;
+    }
+}
+
+/* Limit the smoke to the first `groups' particle groups, killing whatever
+   lives above the new limit.  Kept a multiple of 4 for the vector kernels. */
+void SetSmokeCap(SmokeV *s, int groups)
+{
+    int i, k;
+
+    groups = MAX_(4, MIN_(NUMSMOKEPARTICLES/4, groups & ~3));
+    for (i = groups; i < s->numGroups; i++) {
+	for (k = 0; k < 4; k++)
+	    SmokeSetDead(s, i, k, 1);
+    }
+    if (s->nextParticle >= groups) {
+	s->nextParticle = 0;
+	s->nextSubParticle = 0;
+    }
+    s->numGroups = groups;
+}
+
+#ifdef FLURRY_COMPACT
+/* Birth times are fp16 offsets from timeBase, which only holds a few
+   seconds at useful precision; move the base up to `now' and shift the
+   live particles' offsets down to match. */
+static void RebaseSmoke(SmokeV *s, double now)
+{
+    int i, k;
+    float shift = (float) (now - s->timeBase);
+
+    for (i = 0; i < s->numGroups; i++) {
+	for (k = 0; k < 4; k++) {
+	    if (!SmokeDead(s, i, k))
+		s->c[i].age[k] = FloatToHalf(HalfToFloat(s->c[i].age[k]) - shift);
+	}
+    }
+    s->timeBase = now;
+}
+#endif
+
+/* release new puffs from the star; shared by every update kernel */
+void EmitSmoke(flurry_info_t *flurry, SmokeV *s)
+{
+    int i;
     float sx = flurry->star->position[0];
     float sy = flurry->star->position[1];
     float sz = flurry->star->position[2];
-    double frameRate;
-    double frameRateModifier;
-
 
     s->frame++;
 
+#ifdef FLURRY_COMPACT
+    if (flurry->fTime - s->timeBase > SMOKE_REBASE)
+	RebaseSmoke(s, flurry->fTime);
+#endif
+
     if(!s->firstTime) {
         /* release 12 puffs every frame */
         if(flurry->fTime - s->lastParticleTime >= 1.0f / 121.0f) {
@@ -92,9 +262,9 @@ void UpdateSmoke_ScalarBase(global_info_t *global, flurry_info_t *flurry, SmokeV
                 s->p[s->nextParticle].oldposition[1].f[s->nextSubParticle] = sy;
                 s->p[s->nextParticle].oldposition[2].f[s->nextSubParticle] = sz;
                 streamSpeedCoherenceFactor = MAX_(0.0f,1.0f + RandBell(0.25f*incohesion));
-                dx = s->p[s->nextParticle].position[0].f[s->nextSubParticle] - flurry->spark[i]->position[0];
-                dy = s->p[s->nextParticle].position[1].f[s->nextSubParticle] - flurry->spark[i]->position[1];
-                dz = s->p[s->nextParticle].position[2].f[s->nextSubParticle] - flurry->spark[i]->position[2];
+                dx = s->p[s->nextParticle].position[0].f[s->nextSubParticle] - flurry->spark[i].position[0];
+                dy = s->p[s->nextParticle].position[1].f[s->nextSubParticle] - flurry->spark[i].position[1];
+                dz = s->p[s->nextParticle].position[2].f[s->nextSubParticle] - flurry->spark[i].position[2];
                 rsquared = (dx*dx+dy*dy+dz*dz);
                 f = streamSpeed * streamSpeedCoherenceFactor;
 
@@ -103,19 +273,19 @@ void UpdateSmoke_ScalarBase(global_info_t *global, flurry_info_t *flurry, SmokeV
                 s->p[s->nextParticle].delta[0].f[s->nextSubParticle] -= (dx * mag);
                 s->p[s->nextParticle].delta[1].f[s->nextSubParticle] -= (dy * mag);
                 s->p[s->nextParticle].delta[2].f[s->nextSubParticle] -= (dz * mag);
-                s->p[s->nextParticle].color[0].f[s->nextSubParticle] = flurry->spark[i]->color[0] * (1.0f + RandBell(colorIncoherence));
-                s->p[s->nextParticle].color[1].f[s->nextSubParticle] = flurry->spark[i]->color[1] * (1.0f + RandBell(colorIncoherence));
-                s->p[s->nextParticle].color[2].f[s->nextSubParticle] = flurry->spark[i]->color[2] * (1.0f + RandBell(colorIncoherence));
-                s->p[s->nextParticle].color[3].f[s->nextSubParticle] = 0.85f * (1.0f + RandBell(0.5f*colorIncoherence));
-                s->p[s->nextParticle].time.f[s->nextSubParticle] = flurry->fTime;
-                s->p[s->nextParticle].dead.i[s->nextSubParticle] = 0;
-                s->p[s->nextParticle].animFrame.i[s->nextSubParticle] = random()&63;
+                SmokeSetColor(s, s->nextParticle, 0, s->nextSubParticle, flurry->spark[i].color[0] * (1.0f + RandBell(colorIncoherence)));
+                SmokeSetColor(s, s->nextParticle, 1, s->nextSubParticle, flurry->spark[i].color[1] * (1.0f + RandBell(colorIncoherence)));
+                SmokeSetColor(s, s->nextParticle, 2, s->nextSubParticle, flurry->spark[i].color[2] * (1.0f + RandBell(colorIncoherence)));
+                SmokeSetColor(s, s->nextParticle, 3, s->nextSubParticle, 0.85f * (1.0f + RandBell(0.5f*colorIncoherence)));
+                SmokeSetBirth(s, s->nextParticle, s->nextSubParticle, flurry->fTime);
+                SmokeSetDead(s, s->nextParticle, s->nextSubParticle, 0);
+                SmokeSetFrame(s, s->nextParticle, s->nextSubParticle, RngNext(flurryRng)&63);
                 s->nextSubParticle++;
                 if (s->nextSubParticle==4) {
                     s->nextParticle++;
                     s->nextSubParticle=0;
                 }
-                if (s->nextParticle >= NUMSMOKEPARTICLES/4) {
+                if (s->nextParticle >= s->numGroups) {
                     s->nextParticle = 0;
                     s->nextSubParticle = 0;
                 }
@@ -131,11 +301,27 @@ void UpdateSmoke_ScalarBase(global_info_t *global, flurry_info_t *flurry, SmokeV
     for(i=0;i<3;i++) {
         s->old[i] = flurry->star->position[i];
     }
-    
+}
+
+void UpdateSmoke_ScalarBase(global_info_t *global, flurry_info_t *flurry, SmokeV *s)
+{
+    EmitSmoke(flurry, s);
+    UpdateSmokeRange_Scalar(global, flurry, s, 0, s->numGroups);
+}
+
+/* groups [first, last); EmitSmoke is the caller's */
+void UpdateSmokeRange_Scalar(global_info_t *global, flurry_info_t *flurry, SmokeV *s,
+			     int first, int last)
+{
+    int i,j,k;
+    double frameRate;
+    double frameRateModifier;
+
+    (void) global;
     frameRate = ((double) flurry->dframe)/(flurry->fTime);
     frameRateModifier = 42.5f / frameRate;
 
-    for(i=0;i<NUMSMOKEPARTICLES/4;i++) {        
+    for(i=first;i<last;i++) {        
         for(k=0; k<4; k++) {
             float dx,dy,dz;
             float f;
@@ -145,7 +331,7 @@ void UpdateSmoke_ScalarBase(global_info_t *global, flurry_info_t *flurry, SmokeV
             float deltay;
             float deltaz;
         
-            if (s->p[i].dead.i[k]) {
+            if (SmokeDead(s, i, k)) {
                 continue;
             }
             
@@ -154,9 +340,9 @@ void UpdateSmoke_ScalarBase(global_info_t *global, flurry_info_t *flurry, SmokeV
             deltaz = s->p[i].delta[2].f[k];
             
             for(j=0;j<flurry->numStreams;j++) {
-                dx = s->p[i].position[0].f[k] - flurry->spark[j]->position[0];
-                dy = s->p[i].position[1].f[k] - flurry->spark[j]->position[1];
-                dz = s->p[i].position[2].f[k] - flurry->spark[j]->position[2];
+                dx = s->p[i].position[0].f[k] - flurry->spark[j].position[0];
+                dy = s->p[i].position[1].f[k] - flurry->spark[j].position[1];
+                dz = s->p[i].position[2].f[k] - flurry->spark[j].position[2];
                 rsquared = (dx*dx+dy*dy+dz*dz);
 
                 f = (gravity/rsquared) * frameRateModifier;
@@ -178,7 +364,7 @@ void UpdateSmoke_ScalarBase(global_info_t *global, flurry_info_t *flurry, SmokeV
             deltaz *= flurry->drag;
             
             if((deltax*deltax+deltay*deltay+deltaz*deltaz) >= 25000000.0f) {
-                s->p[i].dead.i[k] = 1;
+                SmokeSetDead(s, i, k, 1);
                 continue;
             }
     
@@ -194,12 +380,24 @@ void UpdateSmoke_ScalarBase(global_info_t *global, flurry_info_t *flurry, SmokeV
     }
 }
 
-void DrawSmoke_Scalar(global_info_t *global, flurry_info_t *flurry, SmokeV *s, float brightness)
+int DrawSmoke_Scalar(global_info_t *global, flurry_info_t *flurry, SmokeV *s, SmokeStaging *st, float brightness)
+{
+	int live = 0;
+	int si = DrawSmokeRange_Scalar(global, flurry, s, st, brightness, 0, s->numGroups, &live);
+
+	s->live = live;
+	return si;
+}
+
+/* groups [first, last) into st from its start; adds the live ones to *live */
+int DrawSmokeRange_Scalar(global_info_t *global, flurry_info_t *flurry, SmokeV *s, SmokeStaging *st,
+			  float brightness, int first, int last, int *live)
 {
 	int svi = 0;
 	int sci = 0;
 	int sti = 0;
 	int si = 0;
+	int alive = 0;
 	float width;
         float sx,sy;
 	float u0,v0,u1,v1;
@@ -211,21 +409,23 @@ void DrawSmoke_Scalar(global_info_t *global, flurry_info_t *flurry, SmokeV *s, f
 
 	width = (streamSize+2.5f*flurry->streamExpansion) * screenRatio;
 
-	for (i=0;i<NUMSMOKEPARTICLES/4;i++)
+	for (i=first;i<last;i++)
 	{
             for (k=0; k<4; k++) {
 		float thisWidth;
                 float oldz;
+		float lodGain = 1.0f;
                 
-                if (s->p[i].dead.i[k]) {
+                if (SmokeDead(s, i, k)) {
                     continue;
 		}
-		thisWidth = (streamSize + (flurry->fTime - s->p[i].time.f[k])*flurry->streamExpansion) * screenRatio;
+		thisWidth = (streamSize + (flurry->fTime - SmokeBirth(s, i, k))*flurry->streamExpansion) * screenRatio;
 		if (thisWidth >= width)
 		{
-			s->p[i].dead.i[k] = 1;
+			SmokeSetDead(s, i, k, 1);
 			continue;
 		}
+		alive++;
 		z = s->p[i].position[2].f[k];
 		sx = s->p[i].position[0].f[k] * global->sys_glWidth / z + wslash2;
 		sy = s->p[i].position[1].f[k] * global->sys_glWidth / z + hslash2;
@@ -235,6 +435,18 @@ void DrawSmoke_Scalar(global_info_t *global, flurry_info_t *flurry, SmokeV *s, f
 			continue;
 		}
 
+		if (thisWidth < global->lodWidth * z)
+		{
+			/* sub-pixel: draw a stable share of these, brighter */
+			float keep = MAX_(LOD_MIN_KEEP, thisWidth / (global->lodWidth * z));
+
+			if (SmokeLodRand(i*4+k, SmokeBirth(s, i, k)) >= keep)
+			{
+				continue;
+			}
+			lodGain = 1.0f / keep;
+		}
+
 		w = MAX_(1.0f,thisWidth/z);
 		{
 			float oldx = s->p[i].oldposition[0].f[k];
@@ -268,6 +480,7 @@ void DrawSmoke_Scalar(global_info_t *global, flurry_info_t *flurry, SmokeV *s, f
 			{
 				floatToVector cmv;
                                 float cm;
+				int frame;
 				float m = 1.0f + sm; 
 		
 				float dxs = dx*sm;
@@ -277,66 +490,106 @@ void DrawSmoke_Scalar(global_info_t *global, flurry_info_t *flurry, SmokeV *s, f
 				float dxm = dx*m;
 				float dym = dy*m;
 		
-				s->p[i].animFrame.i[k]++;
-				if (s->p[i].animFrame.i[k] >= 64)
+				frame = SmokeFrame(s, i, k) + 1;
+				if (frame >= 64)
 				{
-					s->p[i].animFrame.i[k] = 0;
+					frame = 0;
 				}
+				SmokeSetFrame(s, i, k, frame);
 		
-				u0 = (s->p[i].animFrame.i[k]& 7) * 0.125f;
-				v0 = (s->p[i].animFrame.i[k]>>3) * 0.125f;
+				u0 = (frame& 7) * 0.125f;
+				v0 = (frame>>3) * 0.125f;
 				u1 = u0 + 0.125f;
 				v1 = v0 + 0.125f;
 				cm = (1.375f - thisWidth/width);
-				if (s->p[i].dead.i[k] == 3)
+				if (SmokeDead(s, i, k) == 3)
 				{
 					cm *= 0.125f;
-					s->p[i].dead.i[k] = 1;
+					SmokeSetDead(s, i, k, 1);
 				}
 				si++;
-				cm *= brightness;
-				cmv.f[0] = s->p[i].color[0].f[k]*cm;
-				cmv.f[1] = s->p[i].color[1].f[k]*cm;
-				cmv.f[2] = s->p[i].color[2].f[k]*cm;
-				cmv.f[3] = s->p[i].color[3].f[k]*cm;
+				cm *= brightness * lodGain;
+				cmv.f[0] = SmokeColor(s, i, 0, k)*cm;
+				cmv.f[1] = SmokeColor(s, i, 1, k)*cm;
+				cmv.f[2] = SmokeColor(s, i, 2, k)*cm;
+				cmv.f[3] = SmokeColor(s, i, 3, k)*cm;
 
                                 {
                                     int ii, jj;
                                     for (jj = 0; jj < 4; jj++) {
                                         for (ii = 0; ii < 4; ii++) {
-                                            s->seraphimColors[sci].f[ii] = cmv.f[ii];
+                                            st->seraphimColors[sci].f[ii] = cmv.f[ii];
                                         }
                                         sci += 1;
                                     }
                                 }
                                 
-                                s->seraphimTextures[sti++] = u0;
-                                s->seraphimTextures[sti++] = v0;
-                                s->seraphimTextures[sti++] = u0;
-                                s->seraphimTextures[sti++] = v1;
-
-                                s->seraphimTextures[sti++] = u1;
-                                s->seraphimTextures[sti++] = v1;
-                                s->seraphimTextures[sti++] = u1;
-                                s->seraphimTextures[sti++] = v0;
+                                st->seraphimTextures[sti++] = u0;
+                                st->seraphimTextures[sti++] = v0;
+                                st->seraphimTextures[sti++] = u0;
+                                st->seraphimTextures[sti++] = v1;
+
+                                st->seraphimTextures[sti++] = u1;
+                                st->seraphimTextures[sti++] = v1;
+                                st->seraphimTextures[sti++] = u1;
+                                st->seraphimTextures[sti++] = v0;
                                 
-                                s->seraphimVertices[svi].f[0] = sx+dxm-dys;
-                                s->seraphimVertices[svi].f[1] = sy+dym+dxs;
-                                s->seraphimVertices[svi].f[2] = sx+dxm+dys;
-                                s->seraphimVertices[svi].f[3] = sy+dym-dxs;
+                                st->seraphimVertices[svi].f[0] = sx+dxm-dys;
+                                st->seraphimVertices[svi].f[1] = sy+dym+dxs;
+                                st->seraphimVertices[svi].f[2] = sx+dxm+dys;
+                                st->seraphimVertices[svi].f[3] = sy+dym-dxs;
                                 svi++;                            
                         
-                                s->seraphimVertices[svi].f[0] = oldscreenx-dxm+dyos;
-                                s->seraphimVertices[svi].f[1] = oldscreeny-dym-dxos;
-                                s->seraphimVertices[svi].f[2] = oldscreenx-dxm-dyos;
-                                s->seraphimVertices[svi].f[3] = oldscreeny-dym+dxos;
+                                st->seraphimVertices[svi].f[0] = oldscreenx-dxm+dyos;
+                                st->seraphimVertices[svi].f[1] = oldscreeny-dym-dxos;
+                                st->seraphimVertices[svi].f[2] = oldscreenx-dxm-dyos;
+                                st->seraphimVertices[svi].f[3] = oldscreeny-dym+dxos;
                                 svi++;
 			}
 		}
             }
 	}
-	glColorPointer(4,GL_FLOAT,0,s->seraphimColors);
-	glVertexPointer(2,GL_FLOAT,0,s->seraphimVertices);
-	glTexCoordPointer(2,GL_FLOAT,0,s->seraphimTextures);
-	glDrawArrays(GL_QUADS,0,si*4);
+	*live += alive;
+	return si;
+}
+
+int InitSmokeStaging(SmokeStaging *st, int quads)
+{
+	st->seraphimVertices = malloc(quads * 2 * sizeof(floatToVector));
+	st->seraphimColors = malloc(quads * 4 * sizeof(floatToVector));
+	st->seraphimTextures = malloc(quads * 8 * sizeof(float));
+	st->quads = quads;
+	if (!st->seraphimVertices || !st->seraphimColors || !st->seraphimTextures) {
+		FreeSmokeStaging(st);
+		return 0;
+	}
+	return 1;
+}
+
+void FreeSmokeStaging(SmokeStaging *st)
+{
+	free(st->seraphimVertices);
+	free(st->seraphimColors);
+	free(st->seraphimTextures);
+	st->seraphimVertices = NULL;
+	st->seraphimColors = NULL;
+	st->seraphimTextures = NULL;
+	st->quads = 0;
+}
+
+/* quads [first, first + quads) of st, as a staging set of its own */
+void SliceSmokeStaging(SmokeStaging *slice, const SmokeStaging *st, int first, int quads)
+{
+	slice->seraphimVertices = st->seraphimVertices + first * 2;
+	slice->seraphimColors = st->seraphimColors + first * 4;
+	slice->seraphimTextures = st->seraphimTextures + first * 8;
+	slice->quads = quads;
+}
+
+void SubmitSmoke(SmokeStaging *st, int quads)
+{
+	glColorPointer(4,GL_FLOAT,0,st->seraphimColors);
+	glVertexPointer(2,GL_FLOAT,0,st->seraphimVertices);
+	glTexCoordPointer(2,GL_FLOAT,0,st->seraphimTextures);
+	glDrawArrays(GL_QUADS,0,quads*4);
 }
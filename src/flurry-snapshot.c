@@ -0,0 +1,256 @@
+/*
+
+Copyright (c) 2002, Calum Robinson
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+* Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/* Snapshot.c: warm start from a memory-mapped simulation snapshot.
+
+   A fresh flurry starts with every particle dead and takes a few seconds
+   to fill the screen.  With -snapshot the whole simulation is written to
+   a file every so often and at exit, and the next start maps that file
+   back in instead of building the preset, so the first frame is already
+   a full scene.
+
+   The file is laid out so that it can be used in place: a header page,
+   then each flurry's arena block (flurry-arena.c) as it is in memory.
+   Loading maps the file privately and points the flurries into the
+   mapping, so nothing is read or copied
+   until the kernels touch it, and what they write stays private to this
+   process.  Saving writes a new file and renames it over the old one;
+   the old mapping keeps its inode and is not disturbed. */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <flurry.h>
+
+#define SNAPSHOT_MAGIC   0x50534c46 /* "FLSP" */
+#define SNAPSHOT_VERSION 4
+#define SNAPSHOT_PAGE    4096
+
+#define ROUND(x, a) (((x) + (a) - 1) & ~((size_t) (a) - 1))
+
+typedef struct SnapshotHeader
+{
+    int magic;
+    int version;
+    /* a layout guard: any change to these structs invalidates old files */
+    int sizeFlurry;
+    int sizeSmoke;
+    int sizeSpark;
+    int sizeStar;
+    int maxSparks;
+    int preset;
+    int numFlurries;
+    double now;		/* the caller's clock when saved */
+    Governor governor;
+    FlurryRng rng;	/* the scene's; the flurries' are in their blocks */
+} SnapshotHeader;
+
+#define HEADER    ROUND(sizeof(SnapshotHeader), SNAPSHOT_PAGE)
+
+int snapshotEnabled = 0;
+
+static const char *snapshotPath;
+static double snapshotInterval;
+static double snapshotLast;
+
+int SnapshotOpen(const char *path, double interval)
+{
+    snapshotPath = path;
+    snapshotInterval = interval;
+    snapshotEnabled = 1;
+    return 1;
+}
+
+static int SnapshotWrite(int fd, const void *buf, size_t len, off_t off)
+{
+    const char *p = buf;
+    ssize_t n;
+
+    while (len) {
+	if ((n = pwrite(fd, p, len, off)) <= 0)
+	    return 0;
+	p += n;
+	off += n;
+	len -= n;
+    }
+    return 1;
+}
+
+int SnapshotSave(global_info_t *global, double now)
+{
+    SnapshotHeader h;
+    flurry_info_t *flurry, f;
+    char tmp[4096];
+    off_t off;
+    int fd, ok = 1;
+
+    if (!snapshotEnabled)
+	return 0;
+
+    memset(&h, 0, sizeof(h));
+    h.magic = SNAPSHOT_MAGIC;
+    h.version = SNAPSHOT_VERSION;
+    h.sizeFlurry = sizeof(flurry_info_t);
+    h.sizeSmoke = sizeof(SmokeV);
+    h.sizeSpark = sizeof(Spark);
+    h.sizeStar = sizeof(Star);
+    h.maxSparks = MAX_SPARKS;
+    h.preset = global->preset;
+    h.now = now;
+    h.governor = global->governor;
+    h.rng = global->rng;
+    for (flurry = global->flurry; flurry; flurry = flurry->next)
+	h.numFlurries++;
+
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", snapshotPath);
+    if ((fd = mkstemp(tmp)) < 0) {
+	perror(tmp);
+	return 0;
+    }
+
+    ok = SnapshotWrite(fd, &h, sizeof(h), 0);
+    for (flurry = global->flurry, off = HEADER; ok && flurry; flurry = flurry->next) {
+	size_t size = FlurryBlockSize(flurry->numStreams);
+
+	/* the pointers are meaningless on disk; Load fills them in, and
+	   the block will belong to the mapping rather than to the arena */
+	f = *flurry;
+	f.next = NULL;
+	f.s = NULL;
+	f.star = NULL;
+	f.spark = NULL;
+	f.blockSize = 0;
+	ok = SnapshotWrite(fd, &f, sizeof(f), off) &&
+	    SnapshotWrite(fd, (char *) flurry + sizeof(f), size - sizeof(f), off + sizeof(f));
+	off += size;
+    }
+    if (ok)
+	ok = ftruncate(fd, off) == 0;
+    if (close(fd) || !ok || rename(tmp, snapshotPath)) {
+	perror(snapshotPath);
+	unlink(tmp);
+	return 0;
+    }
+
+    snapshotLast = h.now;
+    return 1;
+}
+
+int SnapshotLoad(global_info_t *global, int preset, double *now)
+{
+    const SnapshotHeader *h;
+    flurry_info_t *flurry, **link;
+    struct stat st;
+    char *map;
+    off_t off;
+    int fd, i;
+
+    if (!snapshotEnabled || (fd = open(snapshotPath, O_RDONLY)) < 0)
+	return 0;
+    if (fstat(fd, &st) || st.st_size < (off_t) HEADER) {
+	close(fd);
+	return 0;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+	return 0;
+
+    h = (const SnapshotHeader *) map;
+    if (h->magic != SNAPSHOT_MAGIC || h->version != SNAPSHOT_VERSION ||
+	h->sizeFlurry != sizeof(flurry_info_t) || h->sizeSmoke != sizeof(SmokeV) ||
+	h->sizeSpark != sizeof(Spark) || h->sizeStar != sizeof(Star) ||
+	h->maxSparks != MAX_SPARKS || h->numFlurries <= 0 ||
+	(preset != PRESET_UNKNOWN && preset != h->preset))
+	goto stale;
+
+    /* check every block before hooking any of them up */
+    for (i = 0, off = HEADER; i < h->numFlurries; i++) {
+	if (st.st_size < off + (off_t) sizeof(flurry_info_t))
+	    goto stale;
+	flurry = (flurry_info_t *) (map + off);
+	if (flurry->numStreams < 1 || flurry->numStreams > MAX_SPARKS)
+	    goto stale;
+	off += FlurryBlockSize(flurry->numStreams);
+    }
+    if (st.st_size < off)
+	goto stale;
+
+    global->preset = h->preset;
+    global->flurry = NULL;
+    link = &global->flurry;
+    for (i = 0, off = HEADER; i < h->numFlurries; i++) {
+	flurry = (flurry_info_t *) (map + off);
+	off += FlurryBlockSize(flurry->numStreams);
+	FlurryBlockBind(flurry);
+	flurry->blockSize = 0;
+	flurry->next = NULL;
+	*link = flurry;
+	link = &flurry->next;
+    }
+
+    /* the budget comes from this run's command line; without one the
+       caps a governor left behind would never grow back */
+    if (global->governor.budget > 0.0f) {
+	global->governor.average = h->governor.average;
+	global->governor.quality = h->governor.quality;
+    } else {
+	for (flurry = global->flurry; flurry; flurry = flurry->next)
+	    SetSmokeCap(flurry->s, NUMSMOKEPARTICLES/4);
+    }
+
+    global->rng = h->rng;
+
+    /* for the caller to pick its clock up where the last run left it */
+    *now = h->now;
+    snapshotLast = h->now;
+
+    /* the mapping lives as long as the flurries in it */
+    return 1;
+
+stale:
+    fprintf(stderr, "%s: stale snapshot, starting cold\n", snapshotPath);
+    munmap(map, st.st_size);
+    return 0;
+}
+
+/* called once a frame; saves when the interval is up */
+void SnapshotPoll(global_info_t *global, double now)
+{
+    if (snapshotEnabled && snapshotInterval > 0.0 &&
+	now - snapshotLast >= snapshotInterval)
+	SnapshotSave(global, now);
+}
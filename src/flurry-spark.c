@@ -90,20 +90,22 @@ void DrawSpark(global_info_t *global, flurry_info_t *flurry, Spark *s)
 #define BIGMYSTERY 1800.0
 #define MAXANGLES 16384
 
-void UpdateSparkColour(global_info_t *global, flurry_info_t *flurry, Spark *s)
+/* Everything in a spark update that depends only on the flurry and the
+   clock, worked out once per frame rather than once per spark. */
+typedef struct SparkField {
+	double thisAngle;
+	float cf;
+	float base[3];
+} SparkField;
+
+static void InitSparkField(flurry_info_t *flurry, SparkField *f)
 {
 	const float rotationsPerSecond = (float) (2.0*PI*fieldSpeed/MAXANGLES);
-	double thisPointInRadians;
-	double thisAngle = flurry->fTime*rotationsPerSecond;
-	float cf;
 	float cycleTime = 20.0f;
 	float colorRot;
 	float redPhaseShift;
 	float greenPhaseShift; 
 	float bluePhaseShift;
-	float baseRed;
-	float baseGreen;
-	float baseBlue;
 	float colorTime;
 	
 	if (flurry->currentColorMode == rainbowColorMode)
@@ -129,21 +131,21 @@ void UpdateSparkColour(global_info_t *global, flurry_info_t *flurry, Spark *s)
 	colorTime = flurry->fTime;
 	if (flurry->currentColorMode == whiteColorMode)
 	{
-		baseRed = 0.1875f;
-		baseGreen = 0.1875f;
-		baseBlue = 0.1875f;
+		f->base[0] = 0.1875f;
+		f->base[1] = 0.1875f;
+		f->base[2] = 0.1875f;
 	}
 	else if (flurry->currentColorMode == multiColorMode)
 	{
-		baseRed = 0.0625f;
-		baseGreen = 0.0625f;
-		baseBlue = 0.0625f;
+		f->base[0] = 0.0625f;
+		f->base[1] = 0.0625f;
+		f->base[2] = 0.0625f;
 	}
 	else if (flurry->currentColorMode == darkColorMode)
 	{
-		baseRed = 0.0f;
-		baseGreen = 0.0f;
-		baseBlue = 0.0f;
+		f->base[0] = 0.0f;
+		f->base[1] = 0.0f;
+		f->base[2] = 0.0f;
 	}
 	else
 	{
@@ -155,127 +157,74 @@ void UpdateSparkColour(global_info_t *global, flurry_info_t *flurry, Spark *s)
 		{
 			colorTime = flurry->fTime + flurry->flurryRandomSeed;
 		}
-		baseRed = 0.109375f * ((float) cos((colorTime+redPhaseShift)*colorRot)+1.0f);
-		baseGreen = 0.109375f * ((float) cos((colorTime+greenPhaseShift)*colorRot)+1.0f);
-		baseBlue = 0.109375f * ((float) cos((colorTime+bluePhaseShift)*colorRot)+1.0f);
+		f->base[0] = 0.109375f * ((float) cos((colorTime+redPhaseShift)*colorRot)+1.0f);
+		f->base[1] = 0.109375f * ((float) cos((colorTime+greenPhaseShift)*colorRot)+1.0f);
+		f->base[2] = 0.109375f * ((float) cos((colorTime+bluePhaseShift)*colorRot)+1.0f);
 	}
 	
-	cf = ((float) (cos(7.0*((flurry->fTime)*rotationsPerSecond))+cos(3.0*((flurry->fTime)*rotationsPerSecond))+cos(13.0*((flurry->fTime)*rotationsPerSecond))));
-	cf /= 6.0f;
-	cf += 2.0f;
-	thisPointInRadians = 2.0 * PI * (double) s->mystery / (double) BIGMYSTERY;
-	
-	s->color[0] = baseRed + 0.0625f * (0.5f + (float) cos((15.0 * (thisPointInRadians + 3.0*thisAngle))) + (float) sin((7.0 * (thisPointInRadians + thisAngle))));
-	s->color[1] = baseGreen + 0.0625f * (0.5f + (float) sin(((thisPointInRadians) + thisAngle)));
-	s->color[2] = baseBlue + 0.0625f * (0.5f + (float) cos((37.0 * (thisPointInRadians + thisAngle))));
+	f->thisAngle = flurry->fTime*rotationsPerSecond;
+	f->cf = ((float) (cos(7.0*((flurry->fTime)*rotationsPerSecond))+cos(3.0*((flurry->fTime)*rotationsPerSecond))+cos(13.0*((flurry->fTime)*rotationsPerSecond))));
+	f->cf /= 6.0f;
+	f->cf += 2.0f;
+}
+
+static void SparkColour(const SparkField *f, Spark *s)
+{
+	double thisPointInRadians = 2.0 * PI * (double) s->mystery / (double) BIGMYSTERY;
+	double thisAngle = f->thisAngle;
+
+	s->color[0] = f->base[0] + 0.0625f * (0.5f + (float) cos((15.0 * (thisPointInRadians + 3.0*thisAngle))) + (float) sin((7.0 * (thisPointInRadians + thisAngle))));
+	s->color[1] = f->base[1] + 0.0625f * (0.5f + (float) sin(((thisPointInRadians) + thisAngle)));
+	s->color[2] = f->base[2] + 0.0625f * (0.5f + (float) cos((37.0 * (thisPointInRadians + thisAngle))));
+	s->color[3] = 1.0f;
+}
+
+void UpdateSparkColour(global_info_t *global, flurry_info_t *flurry, Spark *s)
+{
+	SparkField f;
+
+	(void) global;
+	InitSparkField(flurry, &f);
+	SparkColour(&f, s);
+}
+
+static void SparkMove(const SparkField *f, flurry_info_t *flurry, Spark *s)
+{
+	float old[3];
+	int i;
+
+	for (i=0;i<3;i++) {
+		old[i] = s->position[i];
+	}
+
+	SparkColour(f, s);
+	/* the RandBell(5.0f*fieldCoherence) jitter the positions used to
+	   get is always zero; leaving it out saves nine random()s a spark */
+	Trajectory(fieldRange, f->cf, f->thisAngle, (double) s->mystery, s->position);
+
+	for (i=0;i<3;i++) {
+		s->delta[i] = (s->position[i] - old[i])/flurry->fDeltaTime;
+	}
 }
 
 void UpdateSpark(global_info_t *global, flurry_info_t *flurry, Spark *s)
 {
-    const float rotationsPerSecond = (float) (2.0*PI*fieldSpeed/MAXANGLES);
-    double thisPointInRadians;
-    double thisAngle = flurry->fTime*rotationsPerSecond;
-    float cf;
-    int i;
-    double tmpX1,tmpY1,tmpZ1;
-    double tmpX2,tmpY2,tmpZ2;
-    double tmpX3,tmpY3,tmpZ3;
-    double tmpX4,tmpY4,tmpZ4;
-    double rotation;
-    double cr;
-    double sr;
-    float cycleTime = 20.0f;
-    float colorRot;
-    float redPhaseShift;
-    float greenPhaseShift; 
-    float bluePhaseShift;
-    float baseRed;
-    float baseGreen;
-    float baseBlue;
-    float colorTime;
-    
-    float old[3];
-    
-    if (flurry->currentColorMode == rainbowColorMode) {
-        cycleTime = 1.5f;
-    } else if (flurry->currentColorMode == tiedyeColorMode) {
-        cycleTime = 4.5f;
-    } else if (flurry->currentColorMode == cyclicColorMode) {
-        cycleTime = 20.0f;
-    } else if (flurry->currentColorMode == slowCyclicColorMode) {
-        cycleTime = 120.0f;
-    }
-    colorRot = (float) (2.0*PI/cycleTime);
-    redPhaseShift = 0.0f; /* cycleTime * 0.0f / 3.0f */
-    greenPhaseShift = cycleTime / 3.0f; 
-    bluePhaseShift = cycleTime * 2.0f / 3.0f ;
-    colorTime = flurry->fTime;
-    if (flurry->currentColorMode == whiteColorMode) {
-        baseRed = 0.1875f;
-        baseGreen = 0.1875f;
-        baseBlue = 0.1875f;
-    } else if (flurry->currentColorMode == multiColorMode) {
-        baseRed = 0.0625f;
-        baseGreen = 0.0625f;
-        baseBlue = 0.0625f;
-    } else if (flurry->currentColorMode == darkColorMode) {
-        baseRed = 0.0f;
-        baseGreen = 0.0f;
-        baseBlue = 0.0f;
-    } else {
-        if(flurry->currentColorMode < slowCyclicColorMode) {
-            colorTime = (flurry->currentColorMode / 6.0f) * cycleTime;
-        } else {
-            colorTime = flurry->fTime + flurry->flurryRandomSeed;
-        }
-        baseRed = 0.109375f * ((float) cos((colorTime+redPhaseShift)*colorRot)+1.0f);
-        baseGreen = 0.109375f * ((float) cos((colorTime+greenPhaseShift)*colorRot)+1.0f);
-        baseBlue = 0.109375f * ((float) cos((colorTime+bluePhaseShift)*colorRot)+1.0f);
-    }
-    
-    for (i=0;i<3;i++) {
-        old[i] = s->position[i];
-    }
-    
-    cf = ((float) (cos(7.0*((flurry->fTime)*rotationsPerSecond))+cos(3.0*((flurry->fTime)*rotationsPerSecond))+cos(13.0*((flurry->fTime)*rotationsPerSecond))));
-    cf /= 6.0f;
-    cf += 2.0f;
-    thisPointInRadians = 2.0 * PI * (double) s->mystery / (double) BIGMYSTERY;
-    
-    s->color[0] = baseRed + 0.0625f * (0.5f + (float) cos((15.0 * (thisPointInRadians + 3.0*thisAngle))) + (float) sin((7.0 * (thisPointInRadians + thisAngle))));
-    s->color[1] = baseGreen + 0.0625f * (0.5f + (float) sin(((thisPointInRadians) + thisAngle)));
-    s->color[2] = baseBlue + 0.0625f * (0.5f + (float) cos((37.0 * (thisPointInRadians + thisAngle))));
-    s->position[0] = fieldRange * cf * (float) cos(11.0 * (thisPointInRadians + (3.0*thisAngle)));
-    s->position[1] = fieldRange * cf * (float) sin(12.0 * (thisPointInRadians + (4.0*thisAngle)));
-    s->position[2] = fieldRange * (float) cos((23.0 * (thisPointInRadians + (12.0*thisAngle))));
-    
-    rotation = thisAngle*0.501 + 5.01 * (double) s->mystery / (double) BIGMYSTERY;
-    cr = cos(rotation);
-    sr = sin(rotation);
-    tmpX1 = s->position[0] * cr - s->position[1] * sr;
-    tmpY1 = s->position[1] * cr + s->position[0] * sr;
-    tmpZ1 = s->position[2];
-    
-    tmpX2 = tmpX1 * cr - tmpZ1 * sr;
-    tmpY2 = tmpY1;
-    tmpZ2 = tmpZ1 * cr + tmpX1 * sr;
-    
-    tmpX3 = tmpX2;
-    tmpY3 = tmpY2 * cr - tmpZ2 * sr;
-    tmpZ3 = tmpZ2 * cr + tmpY2 * sr + seraphDistance;
-    
-    rotation = thisAngle*2.501 + 85.01 * (double) s->mystery / (double) BIGMYSTERY;
-    cr = cos(rotation);
-    sr = sin(rotation);
-    tmpX4 = tmpX3 * cr - tmpY3 * sr;
-    tmpY4 = tmpY3 * cr + tmpX3 * sr;
-    tmpZ4 = tmpZ3;
-    
-    s->position[0] = (float) tmpX4 + RandBell(5.0f*fieldCoherence);
-    s->position[1] = (float) tmpY4 + RandBell(5.0f*fieldCoherence);
-    s->position[2] = (float) tmpZ4 + RandBell(5.0f*fieldCoherence);
+	SparkField f;
+
+	(void) global;
+	InitSparkField(flurry, &f);
+	SparkMove(&f, flurry, s);
+}
 
-    for (i=0;i<3;i++) {
-        s->delta[i] = (s->position[i] - old[i])/flurry->fDeltaTime;
-    }
+/* Moves the first `count' sparks of a flurry; they all share one field. */
+void UpdateSparks(global_info_t *global, flurry_info_t *flurry, int count)
+{
+	SparkField f;
+	int i;
+
+	(void) global;
+	InitSparkField(flurry, &f);
+	for (i = 0; i < count; i++) {
+		SparkMove(&f, flurry, &flurry->spark[i]);
+	}
 }
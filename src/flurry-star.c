@@ -49,12 +49,9 @@ void InitStar(Star *s)
 #define BIGMYSTERY 1800.0
 #define MAXANGLES 16384
 
-void UpdateStar(global_info_t *global, flurry_info_t *flurry, Star *s)
+void Trajectory(float range, float cf, double thisAngle, double mystery, float position[3])
 {
-    float rotationsPerSecond = (float) (2.0*PI*12.0/MAXANGLES) * s->rotSpeed /* speed control */;
     double thisPointInRadians;
-    double thisAngle = flurry->fTime*rotationsPerSecond;
-    float cf;
     double tmpX1,tmpY1,tmpZ1;
     double tmpX2,tmpY2,tmpZ2;
     double tmpX3,tmpY3,tmpZ3;
@@ -62,24 +59,20 @@ void UpdateStar(global_info_t *global, flurry_info_t *flurry, Star *s)
     double rotation;
     double cr;
     double sr;
+    float p[3];
 
-    s->ate = 0;
+    thisPointInRadians = 2.0 * PI * mystery / (double) BIGMYSTERY;
     
-    cf = ((float) (cos(7.0*((flurry->fTime)*rotationsPerSecond))+cos(3.0*((flurry->fTime)*rotationsPerSecond))+cos(13.0*((flurry->fTime)*rotationsPerSecond))));
-    cf /= 6.0f;
-    cf += 0.75f; 
-    thisPointInRadians = 2.0 * PI * (double) s->mystery / (double) BIGMYSTERY;
-    
-    s->position[0] = 250.0f * cf * (float) cos(11.0 * (thisPointInRadians + (3.0*thisAngle)));
-    s->position[1] = 250.0f * cf * (float) sin(12.0 * (thisPointInRadians + (4.0*thisAngle)));
-    s->position[2] = 250.0f * (float) cos((23.0 * (thisPointInRadians + (12.0*thisAngle))));
+    p[0] = range * cf * (float) cos(11.0 * (thisPointInRadians + (3.0*thisAngle)));
+    p[1] = range * cf * (float) sin(12.0 * (thisPointInRadians + (4.0*thisAngle)));
+    p[2] = range * (float) cos((23.0 * (thisPointInRadians + (12.0*thisAngle))));
     
-    rotation = thisAngle*0.501 + 5.01 * (double) s->mystery / (double) BIGMYSTERY;
+    rotation = thisAngle*0.501 + 5.01 * mystery / (double) BIGMYSTERY;
     cr = cos(rotation);
     sr = sin(rotation);
-    tmpX1 = s->position[0] * cr - s->position[1] * sr;
-    tmpY1 = s->position[1] * cr + s->position[0] * sr;
-    tmpZ1 = s->position[2];
+    tmpX1 = p[0] * cr - p[1] * sr;
+    tmpY1 = p[1] * cr + p[0] * sr;
+    tmpZ1 = p[2];
     
     tmpX2 = tmpX1 * cr - tmpZ1 * sr;
     tmpY2 = tmpY1;
@@ -89,14 +82,28 @@ void UpdateStar(global_info_t *global, flurry_info_t *flurry, Star *s)
     tmpY3 = tmpY2 * cr - tmpZ2 * sr;
     tmpZ3 = tmpZ2 * cr + tmpY2 * sr + seraphDistance;
     
-    rotation = thisAngle*2.501 + 85.01 * (double) s->mystery / (double) BIGMYSTERY;
+    rotation = thisAngle*2.501 + 85.01 * mystery / (double) BIGMYSTERY;
     cr = cos(rotation);
     sr = sin(rotation);
     tmpX4 = tmpX3 * cr - tmpY3 * sr;
     tmpY4 = tmpY3 * cr + tmpX3 * sr;
     tmpZ4 = tmpZ3;
     
-    s->position[0] = (float) tmpX4;
-    s->position[1] = (float) tmpY4;
-    s->position[2] = (float) tmpZ4;
+    position[0] = (float) tmpX4;
+    position[1] = (float) tmpY4;
+    position[2] = (float) tmpZ4;
+}
+
+void UpdateStar(global_info_t *global, flurry_info_t *flurry, Star *s)
+{
+    float rotationsPerSecond = (float) (2.0*PI*12.0/MAXANGLES) * s->rotSpeed /* speed control */;
+    double thisAngle = flurry->fTime*rotationsPerSecond;
+    float cf;
+
+    s->ate = 0;
+    
+    cf = ((float) (cos(7.0*((flurry->fTime)*rotationsPerSecond))+cos(3.0*((flurry->fTime)*rotationsPerSecond))+cos(13.0*((flurry->fTime)*rotationsPerSecond))));
+    cf /= 6.0f;
+    cf += 0.75f; 
+    Trajectory(250.0f, cf, thisAngle, (double) s->mystery, s->position);
 }
@@ -41,16 +41,23 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <flurry.h>
 #include <math.h>
+#include <string.h>
 
 #include <GL/gl.h>
 #include <GL/glu.h>
 
-static GLubyte smallTextureArray[32][32];
-static GLubyte bigTextureArray[256][256][2];
-GLuint theTexture = 0;
+/* the texture under construction; one per MakeTexture call, so scenes
+   in different threads can build theirs at the same time */
+typedef struct TextureBuild
+{
+    GLubyte smallTextureArray[32][32];
+    GLubyte bigTextureArray[256][256][2];
+    int firstTime;
+    FlurryRng *rng;
+} TextureBuild;
 
 /* simple smoothing routine */
-static void SmoothTexture(void)
+static void SmoothTexture(TextureBuild *tb)
 {
     GLubyte filter[32][32];
     int i,j;
@@ -59,11 +66,11 @@ static void SmoothTexture(void)
     {
         for (j=1;j<31;j++)
         {
-            t = (float) smallTextureArray[i][j]*4;
-            t += (float) smallTextureArray[i-1][j];
-            t += (float) smallTextureArray[i+1][j];
-            t += (float) smallTextureArray[i][j-1];
-            t += (float) smallTextureArray[i][j+1];
+            t = (float) tb->smallTextureArray[i][j]*4;
+            t += (float) tb->smallTextureArray[i-1][j];
+            t += (float) tb->smallTextureArray[i+1][j];
+            t += (float) tb->smallTextureArray[i][j-1];
+            t += (float) tb->smallTextureArray[i][j+1];
             t /= 8.0f;
             filter[i][j] = (GLubyte) t;
         }
@@ -72,13 +79,13 @@ static void SmoothTexture(void)
     {
         for (j=1;j<31;j++)
         {
-            smallTextureArray[i][j] = filter[i][j];
+            tb->smallTextureArray[i][j] = filter[i][j];
         }
     }
 }
 
 /* add some randomness to texture data */
-static void SpeckleTexture(void)
+static void SpeckleTexture(TextureBuild *tb)
 {
     int i,j;
     int speck;
@@ -88,31 +95,30 @@ static void SpeckleTexture(void)
         for (j=2;j<30;j++)
         {
             speck = 1;
-            while (speck <= 32 && random() % 2)
+            while (speck <= 32 && RngNext(tb->rng) % 2)
             {
-                t = (float) MIN_(255,smallTextureArray[i][j]+speck);
-                smallTextureArray[i][j] = (GLubyte) t;
+                t = (float) MIN_(255,tb->smallTextureArray[i][j]+speck);
+                tb->smallTextureArray[i][j] = (GLubyte) t;
                 speck+=speck;
             }
             speck = 1;
-            while (speck <= 32 && random() % 2)
+            while (speck <= 32 && RngNext(tb->rng) % 2)
             {
-                t = (float) MAX_(0,smallTextureArray[i][j]-speck);
-                smallTextureArray[i][j] = (GLubyte) t;
+                t = (float) MAX_(0,tb->smallTextureArray[i][j]-speck);
+                tb->smallTextureArray[i][j] = (GLubyte) t;
                 speck+=speck;
             }
         }
     }
 }
 
-static void MakeSmallTexture(void)
+static void MakeSmallTexture(TextureBuild *tb)
 {
-    static int firstTime = 1;
     int i,j;
     float r,t;
-    if (firstTime)
+    if (tb->firstTime)
     {
-        firstTime = 0;
+        tb->firstTime = 0;
         for (i=0;i<32;i++)
         {
             for (j=0;j<32;j++)
@@ -120,12 +126,12 @@ static void MakeSmallTexture(void)
                 r = (float) sqrt((i-15.5)*(i-15.5)+(j-15.5)*(j-15.5));
                 if (r > 15.0f)
                 {
-                    smallTextureArray[i][j] = 0;
+                    tb->smallTextureArray[i][j] = 0;
                 }
                 else
                 {
                     t = 255.0f * (float) cos(r * PI / 31.0);
-                    smallTextureArray[i][j] = (GLubyte) t;
+                    tb->smallTextureArray[i][j] = (GLubyte) t;
                 }
             }
         }
@@ -145,29 +151,29 @@ static void MakeSmallTexture(void)
                 {
                     t = 255.0f * (float) cos(r * PI / 31.0);
                 }
-                smallTextureArray[i][j] = (GLubyte) MIN_(255,(t+smallTextureArray[i][j]+smallTextureArray[i][j])/3);
+                tb->smallTextureArray[i][j] = (GLubyte) MIN_(255,(t+tb->smallTextureArray[i][j]+tb->smallTextureArray[i][j])/3);
             }
         }
     }
-    SpeckleTexture();
-    SmoothTexture();
-    SmoothTexture();
+    SpeckleTexture(tb);
+    SmoothTexture(tb);
+    SmoothTexture(tb);
 }
 
-static void CopySmallTextureToBigTexture(int k, int l)
+static void CopySmallTextureToBigTexture(TextureBuild *tb, int k, int l)
 {
     int i,j;
     for (i=0;i<32;i++)
     {
         for (j=0;j<32;j++)
         {
-            bigTextureArray[i+k][j+l][0] = smallTextureArray[i][j];
-            bigTextureArray[i+k][j+l][1] = smallTextureArray[i][j];
+            tb->bigTextureArray[i+k][j+l][0] = tb->smallTextureArray[i][j];
+            tb->bigTextureArray[i+k][j+l][1] = tb->smallTextureArray[i][j];
         }
     }
 }
 
-static void AverageLastAndFirstTextures(void)
+static void AverageLastAndFirstTextures(TextureBuild *tb)
 {
     int i,j;
     int t;
@@ -175,35 +181,60 @@ static void AverageLastAndFirstTextures(void)
     {
         for (j=0;j<32;j++)
         {
-            t = (smallTextureArray[i][j] + bigTextureArray[i][j][0]) / 2;
-            smallTextureArray[i][j] = (GLubyte) MIN_(255,t);
+            t = (tb->smallTextureArray[i][j] + tb->bigTextureArray[i][j][0]) / 2;
+            tb->smallTextureArray[i][j] = (GLubyte) MIN_(255,t);
         }
     }
 }
 
-void MakeTexture()
+/* the texels alone, for renderers without GL (flurry-raster.c) */
+GLubyte *MakeTextureData(FlurryRng *rng)
 {
+    TextureBuild *tb;
+    GLubyte *data;
     int i,j;
+
+    if (!(tb = malloc(sizeof(TextureBuild))))
+	return NULL;
+    if (!(data = malloc(sizeof(tb->bigTextureArray)))) {
+	free(tb);
+	return NULL;
+    }
+    tb->firstTime = 1;
+    tb->rng = rng;
+
     for (i=0;i<8;i++)
     {
         for (j=0;j<8;j++)
         {
             if (i==7 && j==7)
             {
-                AverageLastAndFirstTextures();
+                AverageLastAndFirstTextures(tb);
             }
             else
             {
-                MakeSmallTexture();
+                MakeSmallTexture(tb);
             }
-            CopySmallTextureToBigTexture(i*32,j*32);
+            CopySmallTextureToBigTexture(tb,i*32,j*32);
         }
     }
+    memcpy(data, tb->bigTextureArray, sizeof(tb->bigTextureArray));
+    free(tb);
+    return data;
+}
+
+GLuint MakeTexture(FlurryRng *rng)
+{
+    GLubyte *data;
+    GLuint texture = 0;
+
+    if (!(data = MakeTextureData(rng)))
+	return 0;
 
     glPixelStorei(GL_UNPACK_ALIGNMENT,1);
 
-    glGenTextures(1, &theTexture);
-    glBindTexture(GL_TEXTURE_2D, theTexture);
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
 
     /* Set the tiling mode (this is generally always GL_REPEAT). */
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -213,6 +244,9 @@ void MakeTexture()
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
 
-    gluBuild2DMipmaps(GL_TEXTURE_2D, 2, 256, 256, GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, bigTextureArray);
+    gluBuild2DMipmaps(GL_TEXTURE_2D, 2, 256, 256, GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, data);
     glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+
+    free(data);
+    return texture;
 }
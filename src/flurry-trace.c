@@ -0,0 +1,223 @@
+/*
+
+Copyright (c) 2002, Calum Robinson
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+* Neither the name of the author nor the names of its contributors may be used
+  to endorse or promote products derived from this software without specific
+  prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/* Trace.c: Chrome trace-event timeline export.
+
+   Every thread that records an event gets its own chain of event chunks,
+   linked into a global list with a compare-and-swap the first time the
+   thread shows up.  Recording never takes a lock: a thread only ever
+   appends to its own chunks and publishes the new count afterwards.
+   The file is (re)written in full at exit, or at the next frame boundary
+   after SIGUSR1, and loads in chrome://tracing or ui.perfetto.dev. */
+
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <flurry.h>
+
+#define TRACE_CHUNK 4096
+
+typedef struct TraceRecord
+{
+    const char *name;
+    double when;
+    int arg;
+    char ph;
+} TraceRecord;
+
+typedef struct TraceChunk
+{
+    struct TraceChunk *next;
+    volatile int count;
+    TraceRecord ev[TRACE_CHUNK];
+} TraceChunk;
+
+typedef struct TraceThread
+{
+    struct TraceThread *next;
+    int tid;
+    char name[32];
+    TraceChunk *head;
+    TraceChunk *tail;
+} TraceThread;
+
+int traceEnabled = 0;
+
+static const char *tracePath;
+static double traceStart;
+static TraceThread *volatile traceThreads;
+static __thread TraceThread *traceSelf;
+static volatile sig_atomic_t flushRequested = 0;
+
+static void TraceSignal(int sig)
+{
+    (void) sig;
+    flushRequested = 1;
+}
+
+int TraceOpen(const char *path)
+{
+    FILE *f;
+
+    /* fail early rather than after a ten minute capture */
+    if (!(f = fopen(path, "w"))) {
+	perror(path);
+	return 0;
+    }
+    fclose(f);
+
+    tracePath = path;
+    traceStart = ProfileClock();
+    traceEnabled = 1;
+
+    signal(SIGUSR1, TraceSignal);
+    atexit(TraceFlush);
+    return 1;
+}
+
+static TraceThread *TraceRegister(void)
+{
+    TraceThread *t = calloc(1, sizeof(TraceThread));
+
+    if (!t)
+	return NULL;
+    t->tid = (int) syscall(SYS_gettid);
+    snprintf(t->name, sizeof(t->name), "thread %d", t->tid);
+    t->head = t->tail = calloc(1, sizeof(TraceChunk));
+    if (!t->head) {
+	free(t);
+	return NULL;
+    }
+
+    do {
+	t->next = traceThreads;
+    } while (!__sync_bool_compare_and_swap(&traceThreads, t->next, t));
+
+    return t;
+}
+
+void TraceThreadName(const char *name)
+{
+    if (!traceEnabled)
+	return;
+    if (!traceSelf && !(traceSelf = TraceRegister()))
+	return;
+    strncpy(traceSelf->name, name, sizeof(traceSelf->name) - 1);
+}
+
+void TraceEvent(const char *name, char ph, double when, int arg)
+{
+    TraceChunk *c;
+    TraceRecord *r;
+
+    if (!traceSelf && !(traceSelf = TraceRegister()))
+	return;
+
+    c = traceSelf->tail;
+    if (c->count == TRACE_CHUNK) {
+	TraceChunk *n = calloc(1, sizeof(TraceChunk));
+
+	if (!n)
+	    return;
+	c->next = n;
+	traceSelf->tail = c = n;
+    }
+
+    r = &c->ev[c->count];
+    r->name = name;
+    r->when = when;
+    r->arg = arg;
+    r->ph = ph;
+    /* make the record visible before the count that covers it */
+    __sync_synchronize();
+    c->count++;
+}
+
+void TraceBegin(const char *name, int arg)
+{
+    if (traceEnabled)
+	TraceEvent(name, 'B', ProfileClock(), arg);
+}
+
+void TraceEnd(const char *name, int arg)
+{
+    if (traceEnabled)
+	TraceEvent(name, 'E', ProfileClock(), arg);
+}
+
+void TracePoll(void)
+{
+    if (flushRequested) {
+	flushRequested = 0;
+	TraceFlush();
+    }
+}
+
+void TraceFlush(void)
+{
+    TraceThread *t;
+    TraceChunk *c;
+    FILE *f;
+    int i, count, first = 1;
+    int pid = (int) getpid();
+
+    if (!traceEnabled || !(f = fopen(tracePath, "w")))
+	return;
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (t = traceThreads; t; t = t->next) {
+	fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+		"\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+		first ? "" : ",\n", pid, t->tid, t->name);
+	first = 0;
+
+	for (c = t->head; c; c = c->next) {
+	    count = c->count;
+	    __sync_synchronize();
+	    for (i = 0; i < count; i++) {
+		TraceRecord *r = &c->ev[i];
+
+		fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,"
+			"\"pid\":%d,\"tid\":%d", r->name, r->ph,
+			(r->when - traceStart) * 1000000.0, pid, t->tid);
+		if (r->arg >= 0)
+		    fprintf(f, ",\"args\":{\"index\":%d}", r->arg);
+		fputc('}', f);
+	    }
+	}
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+}
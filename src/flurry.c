@@ -36,10 +36,16 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include <sys/time.h>
+#include <sys/timerfd.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <unistd.h>
 
 #include <X11/X.h>
 #include <X11/Xlib.h>
 #include <X11/extensions/Xinerama.h>
+#include <X11/extensions/dpms.h>
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -56,9 +62,38 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 # define refresh_flurry 0
 # define flurry_handle_event 0
 
-static char *preset_str;
+/*
+ * Flurry is designed to run at about this rate; much higher than that
+ * and the blending causes the display to saturate, which looks really
+ * ugly.  -accum draws into a float buffer instead (flurry-accum.c) and
+ * runs as fast as the buffer swap lets it.
+ */
+#define FRAME_RATE 60
+#define DPMS_POLL_MS 2000	/* DPMS has no events; ask this often */
+#define DEF_SEED 1		/* what random() starts from unseeded */
 
-global_info_t *flurry_info = NULL;
+static char *preset_str;
+static float frame_budget = 0.0f;	/* seconds, for the governor */
+static float lod_width = 0.0f;
+static float substep_rate = DEF_SUBSTEP_RATE;
+static int field_grid = 0;
+static int frame_rate = FRAME_RATE;	/* 0: paced by the swap alone */
+static int accum_enabled = 0;
+static int fused_smoke = 0;
+static Accum accum;
+static char *snapshot_path;
+static char *record_path;
+static float snapshot_interval = 60.0f;
+
+static volatile sig_atomic_t quit_requested = 0;
+
+/* -wall CxR: that many independent scenes, each in its own tile of the
+   one window; without it the whole window is a single tile */
+#define WALL_MAX 64
+
+static int wall_cols = 1, wall_rows = 1, num_tiles = 1;
+static global_info_t *tile[WALL_MAX];
+static int window_width, window_height;
 
 static double gTimeCounter = 0.0;
 
@@ -76,67 +111,12 @@ void OTSetup (void) {
     }
 }
 
-double TimeInSecondsSinceStart (void) {
-    return currentTime() - gTimeCounter;
+void OTResume (double now) {
+    gTimeCounter = currentTime() - now;
 }
 
-static
-void delete_flurry_info(flurry_info_t *flurry)
-{
-    int i;
-
-    free(flurry->s);
-    free(flurry->star);
-    for (i=0;i<MAX_SPARKS;i++)
-    {
-	free(flurry->spark[i]);
-    }
-    /* free(flurry); */
-}
-
-static
-flurry_info_t *new_flurry_info(global_info_t *global, int streams, ColorModes colour, float thickness, float speed, double bf)
-{
-    int i,k;
-    flurry_info_t *flurry = (flurry_info_t *)malloc(sizeof(flurry_info_t));
-
-    if (!flurry) return NULL;
-
-    flurry->flurryRandomSeed = RandFlt(0.0, 300.0);
-
-	flurry->fOldTime = 0;
-	flurry->fTime = TimeInSecondsSinceStart() + flurry->flurryRandomSeed;
- 	flurry->fDeltaTime = flurry->fTime - flurry->fOldTime;
-
-    flurry->numStreams = streams;
-    flurry->streamExpansion = thickness;
-    flurry->currentColorMode = colour;
-    flurry->briteFactor = bf;
-
-    flurry->s = malloc(sizeof(SmokeV));
-    InitSmoke(flurry->s);
-
-    flurry->star = malloc(sizeof(Star));
-    InitStar(flurry->star);
-    flurry->star->rotSpeed = speed;
-
-    for (i = 0;i < MAX_SPARKS; i++)
-    {
-	flurry->spark[i] = malloc(sizeof(Spark));
-	InitSpark(flurry->spark[i]);
-	flurry->spark[i]->mystery = 1800 * (i + 1) / 13; /* 100 * (i + 1) / (flurry->numStreams + 1); */
-	UpdateSpark(global, flurry, flurry->spark[i]);
-    }
-
-    for (i=0;i<NUMSMOKEPARTICLES/4;i++) {
-	for(k=0;k<4;k++) {
-	    flurry->s->p[i].dead.i[k] = 1;
-	}
-    }
-
-    flurry->next = NULL;
-
-    return flurry;
+double TimeInSecondsSinceStart (void) {
+    return currentTime() - gTimeCounter;
 }
 
 static GLXContext *init_GL(Display *dpy, Window win, Visual *visual)
@@ -250,281 +230,341 @@ void GLSetupRC(global_info_t *global)
     glEnableClientState(GL_TEXTURE_COORD_ARRAY);
 }
 
-static
-void GLRenderScene(global_info_t *global, flurry_info_t *flurry, double b)
+/* a tile's corner in the window; tile 0 is at the top left */
+static void tile_viewport(int i)
 {
-    int i;
-
-    flurry->dframe++;
-
-    flurry->fOldTime = flurry->fTime;
-    flurry->fTime = TimeInSecondsSinceStart() + flurry->flurryRandomSeed;
-    flurry->fDeltaTime = flurry->fTime - flurry->fOldTime;
-
-    flurry->drag = (float) pow(0.9965,flurry->fDeltaTime*85.0);
-
-    UpdateStar(global, flurry, flurry->star);
-
-#ifdef DRAW_SPARKS
-    glShadeModel(GL_SMOOTH);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA,GL_ONE);
-#endif
-
-    for (i=0;i<flurry->numStreams;i++) {
-	flurry->spark[i]->color[0]=1.0;
-	flurry->spark[i]->color[1]=1.0;
-	flurry->spark[i]->color[2]=1.0;
-	flurry->spark[i]->color[2]=1.0;
-	UpdateSpark(global, flurry, flurry->spark[i]);
-#ifdef DRAW_SPARKS
-	DrawSpark(global, flurry, flurry->spark[i]);
-#endif
-    }
-
-    switch(global->optMode) {
-	case OPT_MODE_SCALAR_BASE:
-	    UpdateSmoke_ScalarBase(global, flurry, flurry->s);
-	    break;
-
-	default:
-	    break;
-    }
-
-    /* glDisable(GL_BLEND); */
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA,GL_ONE);
-    glEnable(GL_TEXTURE_2D);
-
-    switch(global->optMode) {
-	case OPT_MODE_SCALAR_BASE:
-	    DrawSmoke_Scalar(global, flurry, flurry->s, b);
-	    break;
-	default:
-	    break;
-    }
+    global_info_t *global = tile[i];
+    int w = (int) global->sys_glWidth, h = (int) global->sys_glHeight;
 
-    glDisable(GL_TEXTURE_2D);
+    glViewport((i % wall_cols) * w, (wall_rows - 1 - i / wall_cols) * h, w, h);
 }
 
-static
-void GLResize(global_info_t *global, float w, float h)
-{
-    global->sys_glWidth = w;
-    global->sys_glHeight = h;
-}
-
-/* new window size or exposure */
+/* new window size or exposure; every tile gets the same share of it.
+   With -pipeline the caller parks the sim thread first. */
 static void reshape_flurry(Display *dpy, int width, int height)
 {
-    global_info_t *global = flurry_info;
+    global_info_t *global = tile[0];
+    int i, w = width / wall_cols, h = height / wall_rows;
 
     glXMakeCurrent(dpy, global->window, *(global->glx_context));
 
+    window_width = width;
+    window_height = height;
     glViewport(0.0, 0.0, width, height);
     glMatrixMode(GL_PROJECTION);
     glLoadIdentity();
-    glOrtho(0, width, 0, height,-1,1);
+    glOrtho(0, w, 0, h,-1,1);
     glMatrixMode(GL_MODELVIEW);
     glClear(GL_COLOR_BUFFER_BIT);
+    if (accum_enabled && !AccumResize(&accum, width, height)) {
+	fprintf(stderr, "-accum: no float framebuffer here, back to %d fps\n",
+		FRAME_RATE);
+	accum_enabled = 0;
+	frame_rate = FRAME_RATE;
+	for (i = 0; i < num_tiles; i++)
+	    tile[i]->accumulate = 0;
+    }
     glFlush();
-    GLResize(global, (float)width, (float)height);
+    for (i = 0; i < num_tiles; i++)
+	SceneResize(tile[i], (float)w, (float)h);
 }
 
+/* one scene per tile; only a lone scene is snapshotted */
 static void init_flurry(Display *dpy, Window win, Visual *visual, int w, int h)
 {
-    int i;
     global_info_t *global;
-    enum {
-	PRESET_INSANE = -1,
-        PRESET_WATER = 0,
-        PRESET_FIRE,
-        PRESET_PSYCHEDELIC,
-        PRESET_RGB,
-        PRESET_BINARY,
-        PRESET_CLASSIC,
-        PRESET_MAX
-    } preset_num;
-
-    if (flurry_info == NULL) {
-	OTSetup();
-	if ((flurry_info = (global_info_t *) calloc(1,
-			sizeof (global_info_t))) == NULL)
-	    return;
-    }
-
-    global = &flurry_info[0];
-
-    global->window = win;
-
-    global->flurry = NULL;
+    FlurryRng seed;
+    int i, preset_num, preset;
+    double now;
 
+    OTSetup();
     if (!preset_str || !*preset_str) preset_str = DEF_PRESET;
-    if (!strcmp(preset_str, "random")) {
-        preset_num = random() % PRESET_MAX;
-    } else if (!strcmp(preset_str, "water")) {
-        preset_num = PRESET_WATER;
-    } else if (!strcmp(preset_str, "fire")) {
-        preset_num = PRESET_FIRE;
-    } else if (!strcmp(preset_str, "psychedelic")) {
-        preset_num = PRESET_PSYCHEDELIC;
-    } else if (!strcmp(preset_str, "rgb")) {
-        preset_num = PRESET_RGB;
-    } else if (!strcmp(preset_str, "binary")) {
-        preset_num = PRESET_BINARY;
-    } else if (!strcmp(preset_str, "classic")) {
-        preset_num = PRESET_CLASSIC;
-    } else if (!strcmp(preset_str, "insane")) {
-        preset_num = PRESET_INSANE;
-    } else {
+    /* "random" takes whichever preset the snapshot was running */
+    preset_num = PRESET_UNKNOWN;
+    if (strcmp(preset_str, "random") &&
+	(preset_num = ParsePreset(preset_str)) == PRESET_UNKNOWN)
         exit(1);
-    }
-
-    switch (preset_num) {
-    case PRESET_WATER: {
-	for (i = 0; i < 9; i++) {
-	    flurry_info_t *flurry;
 
-	    flurry = new_flurry_info(global, 1, blueColorMode, 100.0, 2.0, 2.0);
-	    flurry->next = global->flurry;
-	    global->flurry = flurry;
+    for (i = 0; i < num_tiles; i++) {
+	if (!(tile[i] = SceneCreate(PRESET_UNKNOWN, w / wall_cols, h / wall_rows,
+				    DEF_SEED + i, 0.0)))
+	    exit(1);
+	global = tile[i];
+
+	global->window = win;
+	GovernorInit(&global->governor, frame_budget);
+	global->lodWidth = lod_width;
+	global->substepRate = substep_rate;
+	global->fieldGrid = field_grid;
+	/* time the field now, not in the first frame */
+	FieldFrom(field_grid, global->optMode);
+	global->accumulate = accum_enabled;
+	global->fusedSmoke = fused_smoke;
+
+	if (i == 0 && snapshotEnabled && SnapshotLoad(global, preset_num, &now)) {
+	    OTResume(now);
+	    continue;
 	}
-        break;
+	preset = preset_num == PRESET_UNKNOWN ? ParsePreset(preset_str) : preset_num;
+	seed = global->rng;
+	now = TimeInSecondsSinceStart();
+	if (!CreatePreset(global, preset, now))
+	    exit(1);
+	if (i == 0 && recordEnabled)
+	    RecordStart(global, preset, &seed, now);
     }
-    case PRESET_FIRE: {
-	flurry_info_t *flurry;
 
-	flurry = new_flurry_info(global, 12, slowCyclicColorMode, 10000.0, 0.2, 1.0);
-	flurry->next = global->flurry;
-	global->flurry = flurry;
-        break;
-    }
-    case PRESET_PSYCHEDELIC: {
-	flurry_info_t *flurry;
+    global = tile[0];
+	if (!(global->glx_context = init_GL(dpy, win, visual)))
+		exit(1);
 
-	flurry = new_flurry_info(global, 10, rainbowColorMode, 200.0, 2.0, 1.0);
-	flurry->next = global->flurry;
-	global->flurry = flurry;	
-        break;
-    }
-    case PRESET_RGB: {
-	flurry_info_t *flurry;
+	reshape_flurry(dpy, w, h);
+	GLSetupRC(global);
+}
 
-	flurry = new_flurry_info(global, 3, redColorMode, 100.0, 0.8, 1.0);
-	flurry->next = global->flurry;
-	global->flurry = flurry;	
+/* everything before the flurries: make current and fade the last frame,
+   every tile at once since they all share the clock */
+static int begin_frame(Display *dpy, Window win, GLfloat alpha)
+{
+    global_info_t *global = tile[0];
+    double t;
+    int i;
 
-	flurry = new_flurry_info(global, 3, greenColorMode, 100.0, 0.8, 1.0);
-	flurry->next = global->flurry;
-	global->flurry = flurry;	
+    if (!global->glx_context)
+	return 0;
 
-	flurry = new_flurry_info(global, 3, blueColorMode, 100.0, 0.8, 1.0);
-	flurry->next = global->flurry;
-	global->flurry = flurry;	
-        break;
+    if (!global->texture) {
+	TraceBegin("MakeTexture", -1);
+	global->texture = MakeTexture(&global->rng);
+	for (i = 1; i < num_tiles; i++)
+	    tile[i]->texture = global->texture;
+	TraceEnd("MakeTexture", -1);
     }
-    case PRESET_BINARY: {
-	flurry_info_t *flurry;
+    glDrawBuffer(GL_BACK);
+    glXMakeCurrent(dpy, win, *(global->glx_context));
+    if (accum_enabled)
+	AccumBegin(&accum);
 
-	flurry = new_flurry_info(global, 16, tiedyeColorMode, 1000.0, 0.5, 1.0);
-	flurry->next = global->flurry;
-	global->flurry = flurry;
+    PROFILE_BEGIN(PHASE_FADE, t);
+    glViewport(0, 0, window_width, window_height);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-	flurry = new_flurry_info(global, 16, tiedyeColorMode, 1000.0, 1.5, 1.0);
-	flurry->next = global->flurry;
-	global->flurry = flurry;
-        break;
-    }
-    case PRESET_CLASSIC: {
-	flurry_info_t *flurry;
+    glColor4f(0.0, 0.0, 0.0, alpha);
+    glRectd(0, 0, global->sys_glWidth, global->sys_glHeight);
+    PROFILE_END(PHASE_FADE, t);
+    return 1;
+}
 
-	flurry = new_flurry_info(global, 5, tiedyeColorMode, 10000.0, 1.0, 1.0);
-	flurry->next = global->flurry;
-	global->flurry = flurry;
-        break;
+/* and after: overlay, wait for GL, swap; returns when the GL work ended */
+static double end_frame(Display *dpy, Window win)
+{
+    global_info_t *global = tile[0];
+    double t, done;
+
+    if (accum_enabled)
+	AccumEnd(&accum);
+    if (profileEnabled) {
+	tile_viewport(0);
+	ProfileDrawHUD(dpy, global);
     }
-    case PRESET_INSANE: {
-	flurry_info_t *flurry;
 
-	flurry = new_flurry_info(global, 64, tiedyeColorMode, 1000.0, 0.5, 0.5);
-	flurry->next = global->flurry;
-	global->flurry = flurry;
+    PROFILE_BEGIN(PHASE_SWAP, t);
+    glFinish();
+    done = ProfileClock();
+    glXSwapBuffers(dpy, win);
+    PROFILE_END(PHASE_SWAP, t);
+    return done;
+}
 
-        break;
-    }
-    default: {
-        exit(1);
-    }
+/*
+ * A frame is built by SceneBuild into a frame slot, one SceneFrame per
+ * tile, and drawn from there, so the GL side never looks at the
+ * flurries.  With -pipeline the stepping and building move to a second
+ * thread that runs one frame ahead of the GL thread, filling the two
+ * slots in turn; anything else that touches the flurries (the governor,
+ * snapshots) runs on the sim thread too.  Without it both halves run
+ * here, on slot 0.
+ */
+static int use_pipeline = 0;
+static Pipeline pipeline;
+static SceneFrame frame_slot[2][WALL_MAX];
+static volatile double prepare_work;	/* CPU time of the last frame */
+static volatile double render_work;	/* GL time of the last frame */
+
+static void prepare_frame(void *ctx, int slot)
+{
+    double now = TimeInSecondsSinceStart();
+    double workStart;
+    float quality = tile[0]->governor.quality;
+    float width = tile[0]->sys_glWidth, height = tile[0]->sys_glHeight;
+    int i, n, live;
+
+    (void) ctx;
+    workStart = ProfileClock();
+    for (i = 0; i < num_tiles; i++) {
+	TraceBegin("tile", i);
+	SceneStepBuild(tile[i], now, &frame_slot[slot][i]);
+	TraceEnd("tile", i);
     }
+    prepare_work = ProfileClock() - workStart;
 
-	if (!(global->glx_context = init_GL(dpy, win, visual)))
-		exit(1);
+    if (recordEnabled) {
+	for (n = 0, live = 0; n < frame_slot[slot][0].numFlurries; n++)
+	    live += frame_slot[slot][0].live[n];
+	RecordStep(now, width, height, quality, live);
+    }
 
-	reshape_flurry(dpy, w, h);
-	GLSetupRC(global);
+    /* the frame rate is set by whichever stage is slower; the tiles
+       share the budget, so each sees the whole wall's time */
+    if (use_pipeline && frame_budget > 0.0f) {
+	for (i = 0; i < num_tiles; i++)
+	    GovernorUpdate(tile[i], MAX_(prepare_work, render_work));
+    }
+    if (snapshotEnabled)
+	SnapshotPoll(tile[0], now);
+    /* the sim thread's phases, before the slot is handed over */
+    if (use_pipeline && profileEnabled)
+	ProfilePublish();
 }
 
-static void draw_flurry(Display *dpy, Window win)
+/* The GL state is set up once for the whole wall; each tile is then a
+   viewport change and a single draw of all its flurries' quads. */
+static void render_frame(Display *dpy, Window win, SceneFrame *f)
 {
-    static int first = 1;
-    static double oldFrameTime = -1;
-    double newFrameTime;
-    double deltaFrameTime = 0;
-    double brite;
-    GLfloat alpha;
-
-    global_info_t *global = flurry_info;
-    flurry_info_t *flurry;
-
-    newFrameTime = currentTime();
-    if (oldFrameTime == -1) {
-	/* special case the first frame -- clear to black */
-	alpha = 1.0;
-    } else {
-	/* 
-	 * this clamps the speed at below 60fps and, here
-	 * at least, produces a reasonably accurate 50fps.
-	 * (probably part CPU speed and part scheduler).
-	 *
-	 * Flurry is designed to run at this speed; much higher
-	 * than that and the blending causes the display to
-	 * saturate, which looks really ugly.
-	 */
-	if (newFrameTime - oldFrameTime < 1/60.0) {
-	    usleep(MAX_(1,(int)(20000 * (newFrameTime - oldFrameTime))));
-	    return;
+    double t, workStart;
+    int i, n;
+
+    workStart = ProfileClock();
+
+    if (!begin_frame(dpy, win, f[0].alpha))
+	return;
 
+#ifdef DRAW_SPARKS
+    glShadeModel(GL_SMOOTH);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA,GL_ONE);
+    for (i = 0; i < num_tiles; i++) {
+	flurry_info_t *flurry;
+	int k;
+
+	tile_viewport(i);
+	/* numStreams never changes after the preset is built */
+	for (flurry = tile[i]->flurry, n = 0; flurry && n < f[i].numFlurries;
+	     flurry = flurry->next, n++) {
+	    for (k = 0; k < flurry->numStreams; k++)
+		DrawSpark(tile[i], flurry, &f[i].sparks[n * MAX_SPARKS + k]);
 	}
-	deltaFrameTime = newFrameTime - oldFrameTime;
-	alpha = 5.0 * deltaFrameTime;
     }
-    oldFrameTime = newFrameTime;
+#endif
 
-    if (alpha > 0.2) alpha = 0.2;
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA,GL_ONE);
+    glEnable(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, tile[0]->texture);
+
+    PROFILE_BEGIN(PHASE_SUBMIT, t);
+    for (i = 0; i < num_tiles; i++) {
+	TraceBegin("tile", i);
+	tile_viewport(i);
+	SubmitSmoke(&f[i].staging, f[i].allQuads);
+	TraceEnd("tile", i);
+    }
+    PROFILE_END(PHASE_SUBMIT, t);
 
-    if (!global->glx_context)
-	return;
+    glDisable(GL_TEXTURE_2D);
 
-    if (first) {
-	MakeTexture();
-	first = 0;
+    /* the overlay has room for one scene's flurries, or for the tiles */
+    if (profileEnabled) {
+	if (num_tiles == 1) {
+	    for (n = 0; n < f[0].numFlurries; n++)
+		ProfileParticles(n, f[0].live[n]);
+	} else {
+	    for (i = 0; i < num_tiles; i++) {
+		int live = 0;
+
+		for (n = 0; n < f[i].numFlurries; n++)
+		    live += f[i].live[n];
+		ProfileParticles(i, live);
+	    }
+	}
     }
-    glDrawBuffer(GL_BACK);
-    glXMakeCurrent(dpy, win, *(global->glx_context));
 
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    render_work = end_frame(dpy, win) - workStart;
+}
 
-    glColor4f(0.0, 0.0, 0.0, alpha);
-    glRectd(0, 0, global->sys_glWidth, global->sys_glHeight);
+static int start_frames(const char *progname)
+{
+    int i, ok = 1;
 
-    brite = pow(deltaFrameTime,0.75) * 10;
-    for (flurry = global->flurry; flurry; flurry=flurry->next) {
-	GLRenderScene(global, flurry, brite * flurry->briteFactor);
+    for (i = 0; i < num_tiles; i++) {
+	if (!SceneFrameInit(&frame_slot[0][i], tile[i]))
+	    return 0;
     }
+    if (!use_pipeline)
+	return 1;
+
+    for (i = 0; i < num_tiles; i++)
+	ok = ok && SceneFrameInit(&frame_slot[1][i], tile[i]);
+
+    /* the flurries belong to the sim thread from here on */
+    if (!ok || !PipelineStart(&pipeline, prepare_frame, NULL)) {
+	fprintf(stderr, "%s: can't start the sim thread\n", progname);
+	for (i = 0; i < num_tiles; i++)
+	    SceneFrameFree(&frame_slot[1][i]);
+	use_pipeline = 0;
+    }
+    return 1;
+}
 
-    glFinish();
-    glXSwapBuffers(dpy, win);
+static void publish_metrics(SceneFrame *f, int dropped)
+{
+    static double last = 0.0;
+    double now = ProfileClock();
+    MetricsSample s;
+    int i, n;
+
+    s.interval = last > 0.0 ? now - last : 0.0;
+    s.work = use_pipeline ? MAX_(prepare_work, render_work) :
+	prepare_work + render_work;
+    s.live = s.quads = 0;
+    for (i = 0; i < num_tiles; i++) {
+	for (n = 0; n < f[i].numFlurries; n++)
+	    s.live += f[i].live[n];
+	s.quads += f[i].allQuads;
+    }
+    s.dropped = dropped;
+    MetricsFrame(&s);
+    last = now;
+}
+
+/* `dropped' frame ticks went by since the last call */
+static void draw_frame(Display *dpy, Window win, int dropped)
+{
+    double frameStart;
+    int i, slot = 0;
+
+    if (use_pipeline)
+	slot = PipelineAcquire(&pipeline);
+
+    PROFILE_BEGIN(PHASE_FRAME, frameStart);
+    if (!use_pipeline)
+	prepare_frame(NULL, slot);
+    render_frame(dpy, win, frame_slot[slot]);
+    if (!use_pipeline && frame_budget > 0.0f) {
+	for (i = 0; i < num_tiles; i++)
+	    GovernorUpdate(tile[i], prepare_work + render_work);
+    }
+    PROFILE_END(PHASE_FRAME, frameStart);
+
+    if (metricsEnabled)
+	publish_metrics(frame_slot[slot], dropped);
+    if (use_pipeline)
+	PipelineRelease(&pipeline, slot);
+    if (profileEnabled)
+	ProfileEndFrame();
+    if (traceEnabled)
+	TracePoll();
 }
 
 #if 0
@@ -540,7 +580,8 @@ static void release_flurry(ModeInfo * mi)
 	    glXMakeCurrent(MI_DISPLAY(mi), global->window, *(global->glx_context));
 	}
 
-	for (flurry = global->flurry; flurry; flurry=flurry->next) {
+	while ((flurry = global->flurry)) {
+	    global->flurry = flurry->next;
 	    delete_flurry_info(flurry);
 	}
 	(void) free((void *) flurry_info);
@@ -550,6 +591,158 @@ static void release_flurry(ModeInfo * mi)
 }
 #endif
 
+static int dpms_off(Display *dpy)
+{
+	int dummy;
+	CARD16 level;
+	BOOL enabled;
+
+	if (!DPMSQueryExtension(dpy, &dummy, &dummy) || !DPMSCapable(dpy))
+		return 0;
+	if (!DPMSInfo(dpy, &level, &enabled))
+		return 0;
+	return enabled && level != DPMSModeOn;
+}
+
+/* tick `rate' times a second; 0 stops the timer */
+static void set_frame_timer(int tfd, int rate)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	if (rate) {
+		its.it_interval.tv_nsec = 1000000000 / rate;
+		its.it_value = its.it_interval;
+	}
+	timerfd_settime(tfd, 0, &its, NULL);
+}
+
+/*
+ * Waits on the X connection and a frame timer.  While the window is
+ * unmapped, fully obscured or the monitor is blanked, the timer is
+ * stopped and so is the simulation clock: nothing is simulated or drawn
+ * until something can be seen again, and it then picks up where it left
+ * off rather than jumping ahead by the time spent hidden.
+ */
+static void run_flurry(Display *dpy, Window win)
+{
+	struct pollfd pfd[2];
+	XEvent ev;
+	uint64_t ticks;
+	double paused = TimeInSecondsSinceStart(), lastDpms = 0.0;
+	int mapped = 1, obscured = 0, blanked = 0, running = 0;
+	int tfd, i, armed = 0;
+
+	if ((tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+		perror("timerfd_create");
+		exit(1);
+	}
+
+	XSelectInput(dpy, win, StructureNotifyMask | VisibilityChangeMask |
+		     ExposureMask);
+
+	pfd[0].fd = ConnectionNumber(dpy);
+	pfd[0].events = POLLIN;
+	pfd[1].fd = tfd;
+	pfd[1].events = POLLIN;
+
+	while (!quit_requested) {
+		while (XPending(dpy)) {
+			XNextEvent(dpy, &ev);
+			switch (ev.type) {
+			case ConfigureNotify:
+				if (ev.xconfigure.width == window_width &&
+				    ev.xconfigure.height == window_height)
+					break;
+				/* the sim thread reads the scenes' size and
+				   -accum state; park it first */
+				if (use_pipeline)
+					PipelineIdle(&pipeline);
+				reshape_flurry(dpy, ev.xconfigure.width,
+					       ev.xconfigure.height);
+				break;
+			case MapNotify:
+				mapped = 1;
+				break;
+			case UnmapNotify:
+				mapped = 0;
+				break;
+			case VisibilityNotify:
+				obscured = ev.xvisibility.state == VisibilityFullyObscured;
+				break;
+			default:
+				/* Expose: the next frame repaints everything */
+				break;
+			}
+		}
+
+		if (currentTime() - lastDpms >= DPMS_POLL_MS / 1000.0) {
+			blanked = dpms_off(dpy);
+			lastDpms = currentTime();
+		}
+
+		if (running != (mapped && !obscured && !blanked)) {
+			running = !running;
+			/* park the sim thread before touching its clocks */
+			if (use_pipeline)
+				PipelineIdle(&pipeline);
+			if (running) {
+				OTResume(paused);
+				for (i = 0; i < num_tiles; i++)
+					tile[i]->lastStep = -1.0;
+			} else {
+				paused = TimeInSecondsSinceStart();
+			}
+		}
+		/* a failed -accum resize can put the cap back at any time */
+		if (armed != (running ? frame_rate : 0)) {
+			armed = running ? frame_rate : 0;
+			set_frame_timer(tfd, armed);
+		}
+
+		/* uncapped: glXSwapBuffers holds us to the refresh rate, if
+		   the driver syncs to it */
+		if (running && !frame_rate) {
+			draw_frame(dpy, win, 0);
+			continue;
+		}
+
+		TraceBegin("wait", -1);
+		if (poll(pfd, 2, DPMS_POLL_MS) < 0) {
+			TraceEnd("wait", -1);
+			continue;	/* EINTR: go and look at quit_requested */
+		}
+		TraceEnd("wait", -1);
+
+		if ((pfd[1].revents & POLLIN) &&
+		    read(tfd, &ticks, sizeof(ticks)) == sizeof(ticks) && running)
+			draw_frame(dpy, win, (int) ticks - 1);
+	}
+
+	close(tfd);
+}
+
+static void request_quit(int sig)
+{
+	(void) sig;
+	quit_requested = 1;
+}
+
+static int usage(const char *progname)
+{
+	fprintf(stderr, "usage: %s [-preset name] [-fps] [-trace file.json] [-budget ms]\n"
+			"       [-lod px] [-snapshot file] [-snapshot-interval s] [-hugepages]\n"
+			"       [-pipeline] [-prep n] [-fused] [-substep hz] [-wall CxR] [-counters]\n"
+			"       [-field n] [-metrics socket|port] [-accum] [-record file.rec]\n"
+			"       %s -golden [options]  (see -golden -help)\n"
+			"       %s -bench [options]   (see -bench -help)\n"
+			"       %s -replay file.rec [options]\n"
+			"       %s -headless -sink socket [options]  (see -headless -help)\n"
+			"  presets: random water fire psychedelic rgb binary "
+			"classic insane\n", progname, progname, progname, progname, progname);
+	return 1;
+}
+
 int main(int argc, char **argv)
 {
 	Display *dpy;
@@ -559,6 +752,87 @@ int main(int argc, char **argv)
 	XEvent xev;
 	int i, j;
 
+	if (argc > 1 && !strcmp(argv[1], "-golden"))
+		return GoldenMain(argc - 1, argv + 1);
+	if (argc > 1 && !strcmp(argv[1], "-bench"))
+		return BenchMain(argc - 1, argv + 1);
+	if (argc > 1 && !strcmp(argv[1], "-replay"))
+		return ReplayMain(argc - 1, argv + 1);
+	if (argc > 1 && !strcmp(argv[1], "-headless"))
+		return HeadlessMain(argc - 1, argv + 1);
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-preset") && i + 1 < argc)
+			preset_str = argv[++i];
+		else if (!strcmp(argv[i], "-fps"))
+			profileEnabled = 1;
+		else if (!strcmp(argv[i], "-counters")) {
+			profileEnabled = 1;
+			CountersOpen();
+		}
+		else if (!strcmp(argv[i], "-substep") && i + 1 < argc)
+			substep_rate = atof(argv[++i]);
+		else if (!strcmp(argv[i], "-field") && i + 1 < argc) {
+			field_grid = atoi(argv[++i]);
+			if (field_grid != 0 && !FieldGridValid(field_grid))
+				return usage(argv[0]);
+		}
+		else if (!strcmp(argv[i], "-lod") && i + 1 < argc)
+			lod_width = atof(argv[++i]);
+		else if (!strcmp(argv[i], "-budget") && i + 1 < argc)
+			frame_budget = atof(argv[++i]) / 1000.0f;
+		else if (!strcmp(argv[i], "-accum")) {
+			accum_enabled = 1;
+			frame_rate = 0;
+		}
+		else if (!strcmp(argv[i], "-pipeline"))
+			use_pipeline = 1;
+		else if (!strcmp(argv[i], "-fused"))
+			fused_smoke = 1;
+		else if (!strcmp(argv[i], "-prep") && i + 1 < argc) {
+			if (!PrepStart(atoi(argv[++i])))
+				return 1;
+		}
+		else if (!strcmp(argv[i], "-wall") && i + 1 < argc) {
+			if (sscanf(argv[++i], "%dx%d", &wall_cols, &wall_rows) != 2 ||
+			    wall_cols < 1 || wall_rows < 1 ||
+			    wall_cols * wall_rows > WALL_MAX)
+				return usage(argv[0]);
+			num_tiles = wall_cols * wall_rows;
+		}
+		else if (!strcmp(argv[i], "-hugepages"))
+			arenaHugePages = 1;
+		else if (!strcmp(argv[i], "-snapshot") && i + 1 < argc)
+			snapshot_path = argv[++i];
+		else if (!strcmp(argv[i], "-record") && i + 1 < argc)
+			record_path = argv[++i];
+		else if (!strcmp(argv[i], "-snapshot-interval") && i + 1 < argc)
+			snapshot_interval = atof(argv[++i]);
+		else if (!strcmp(argv[i], "-metrics") && i + 1 < argc) {
+			if (!MetricsOpen(argv[++i]))
+				return 1;
+		} else if (!strcmp(argv[i], "-trace") && i + 1 < argc) {
+			if (!TraceOpen(argv[++i]))
+				return 1;
+		} else
+			return usage(argv[0]);
+	}
+
+	if (snapshot_path && num_tiles > 1) {
+		fprintf(stderr, "%s: -snapshot takes a single scene, not a -wall\n", argv[0]);
+		return 1;
+	}
+	/* a recording starts from a preset, on its own */
+	if (record_path && (snapshot_path || num_tiles > 1)) {
+		fprintf(stderr, "%s: -record takes a single scene built from its preset,\n"
+			"not a -wall or a -snapshot\n", argv[0]);
+		return 1;
+	}
+	if (snapshot_path)
+		SnapshotOpen(snapshot_path, snapshot_interval);
+	if (record_path && !RecordOpen(record_path))
+		return 1;
+
 	if (!(dpy = XOpenDisplay(NULL)))
 		return 1;
 
@@ -600,8 +874,23 @@ int main(int argc, char **argv)
 
 	printf("%d x %d\n", screens[i].width, screens[i].height);
 
-	for (;;)
-		draw_flurry(dpy, win);
+	/* leave through exit() so atexit handlers (the tracer) run */
+	signal(SIGINT, request_quit);
+	signal(SIGTERM, request_quit);
+
+	TraceThreadName("render");
+	if (!start_frames(argv[0]))
+		return 1;
+	run_flurry(dpy, win);
+
+	if (use_pipeline)
+		PipelineStop(&pipeline);
+	/* the scene's own clock, as SnapshotPoll saves it; the wall clock
+	   would count the time spent hidden.  Right after a resume nothing
+	   has stepped, and the wall clock has just been rebased. */
+	if (snapshotEnabled)
+		SnapshotSave(tile[0], tile[0]->lastStep >= 0.0 ?
+			     tile[0]->lastStep : TimeInSecondsSinceStart());
 
 	return 0;
 }
@@ -39,15 +39,46 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <stdlib.h>
 #include <math.h>
+#include <pthread.h>
 
 typedef struct _global_info_t global_info_t;
 typedef struct _flurry_info_t flurry_info_t;
 
-static double _frand_tmp_;
-# define frand(f)							\
-  (_frand_tmp_ = ((((double) random()) * ((double) (f))) /		\
-		  ((double) ((unsigned int)~0))),			\
-   _frand_tmp_ < 0 ? (-_frand_tmp_) : _frand_tmp_)
+/* flurry-scene.c: random() without the process-wide state.  The same
+   additive feedback generator as glibc's random() with a 128-byte state,
+   but held by value, so a scene and each of its flurries can carry one
+   and snapshots and copies of them just work. */
+typedef struct FlurryRng
+{
+	unsigned int r[31];
+	int f, b;		/* front and rear taps */
+} FlurryRng;
+
+/* the generator the simulation draws from on this thread; StepFlurry
+   and new_flurry_info bind their own around their work */
+extern __thread FlurryRng *flurryRng;
+
+void RngSeed(FlurryRng *rng, unsigned int seed);
+/* make rng this thread's generator; returns the one it replaces */
+FlurryRng *RngBind(FlurryRng *rng);
+
+static inline long RngNext(FlurryRng *rng)
+{
+    unsigned int v = rng->r[rng->f] += rng->r[rng->b];
+
+    if (++rng->f == 31)
+	rng->f = 0;
+    if (++rng->b == 31)
+	rng->b = 0;
+    return v >> 1;
+}
+
+static inline double frand(double f)
+{
+    double t = ((double) RngNext(flurryRng) * f) / ((double) ((unsigned int)~0));
+
+    return t < 0 ? -t : t;
+}
 
 #define sqr(X)     ((X) * (X))
 #define PI         3.14159265358979323846f
@@ -74,39 +105,318 @@ typedef union {
     unsigned int	i[4];
 } intToVector;
 
+/* A group of four smoke particles is split in two: what the update
+   kernels walk every frame, and what only emission and drawing read.
+
+   Building with -DFLURRY_COMPACT (make COMPACT=1) packs the second half
+   and the dead flags: colours as unorm8, the birth time as an fp16
+   offset from SmokeV.timeBase, and dead plus animFrame in one byte per
+   particle.  Positions and deltas stay float.  That is 172 bytes per
+   group instead of 256.  Everything outside the smoke kernels goes
+   through the accessors below, which hide the difference. */
+#ifndef FLURRY_COMPACT
+
 typedef struct SmokeParticleV  
 {
-	floatToVector color[4];
 	floatToVector position[3];
 	floatToVector oldposition[3];
 	floatToVector delta[3];
 	intToVector dead;
+} SmokeParticleV;
+
+typedef struct SmokeColdV
+{
+	floatToVector color[4];
 	floatToVector time;
 	intToVector animFrame;
+} SmokeColdV;
+
+#else
+
+typedef struct SmokeParticleV  
+{
+	floatToVector position[3];
+	floatToVector oldposition[3];
+	floatToVector delta[3];
 } SmokeParticleV;
 
+typedef struct SmokeColdV
+{
+	unsigned char color[4][4];	/* [channel][particle], unorm8 */
+	unsigned short age[4];		/* birth - timeBase, fp16 */
+} SmokeColdV;
+
+#define SMOKE_DEAD_SHIFT 6		/* state: dead << 6 | animFrame */
+#define SMOKE_FRAME_MASK 63
+#define SMOKE_REBASE 4.0		/* seconds of offset before timeBase moves */
+
+#endif /* FLURRY_COMPACT */
+
 #define NUMSMOKEPARTICLES 3600
 
 typedef struct SmokeV  
 {
 	SmokeParticleV p[NUMSMOKEPARTICLES/4];
+	SmokeColdV c[NUMSMOKEPARTICLES/4];
+#ifdef FLURRY_COMPACT
+	unsigned char state[NUMSMOKEPARTICLES];
+	double timeBase;
+#endif
 	int nextParticle;
         int nextSubParticle;
+	int numGroups;		/* groups of p[] in use; see SetSmokeCap */
 	float lastParticleTime;
 	int firstTime;
 	long frame;
+	int live;
 	float old[3];
-        floatToVector seraphimVertices[NUMSMOKEPARTICLES*2+1];
-        floatToVector seraphimColors[NUMSMOKEPARTICLES*4+1];
-	float seraphimTextures[NUMSMOKEPARTICLES*2*4];
 } SmokeV;
 
+#ifndef FLURRY_COMPACT
+
+static inline unsigned int SmokeDead(const SmokeV *s, int i, int k)
+{
+    return s->p[i].dead.i[k];
+}
+
+static inline void SmokeSetDead(SmokeV *s, int i, int k, unsigned int dead)
+{
+    s->p[i].dead.i[k] = dead;
+}
+
+static inline int SmokeFrame(const SmokeV *s, int i, int k)
+{
+    return s->c[i].animFrame.i[k];
+}
+
+static inline void SmokeSetFrame(SmokeV *s, int i, int k, int frame)
+{
+    s->c[i].animFrame.i[k] = frame;
+}
+
+static inline float SmokeColor(const SmokeV *s, int i, int c, int k)
+{
+    return s->c[i].color[c].f[k];
+}
+
+static inline void SmokeSetColor(SmokeV *s, int i, int c, int k, float v)
+{
+    s->c[i].color[c].f[k] = v;
+}
+
+static inline float SmokeBirth(const SmokeV *s, int i, int k)
+{
+    return s->c[i].time.f[k];
+}
+
+static inline void SmokeSetBirth(SmokeV *s, int i, int k, double t)
+{
+    s->c[i].time.f[k] = t;
+}
+
+#else
+
+/* IEEE half precision, round to nearest even; no NaN payloads */
+static inline unsigned short FloatToHalf(float f)
+{
+    union { float f; unsigned int u; } x;
+    unsigned int sign, mant, exp;
+
+    x.f = f;
+    sign = (x.u >> 16) & 0x8000;
+    exp = (x.u >> 23) & 0xff;
+    mant = x.u & 0x7fffff;
+
+    if (exp == 0xff)
+	return sign | 0x7c00 | (mant ? 0x200 : 0);
+    if (exp > 142)			/* too big: infinity */
+	return sign | 0x7c00;
+    if (exp < 113) {			/* subnormal or zero */
+	unsigned int shift;
+
+	if (exp < 102)
+	    return sign;
+	mant |= 0x800000;
+	shift = 126 - exp;
+	x.u = mant >> shift;
+	if ((mant >> (shift - 1)) & 1 && ((mant & ((1u << (shift - 1)) - 1)) || (x.u & 1)))
+	    x.u++;
+	return sign | x.u;
+    }
+    x.u = ((exp - 112) << 10) | (mant >> 13);
+    if ((mant & 0x1000) && ((mant & 0xfff) || (x.u & 1)))
+	x.u++;				/* may carry into the exponent; fine */
+    return sign | x.u;
+}
+
+static inline float HalfToFloat(unsigned short h)
+{
+    union { float f; unsigned int u; } x;
+    unsigned int sign = (h & 0x8000) << 16;
+    unsigned int exp = (h >> 10) & 0x1f;
+    unsigned int mant = h & 0x3ff;
+
+    if (exp == 0x1f) {
+	x.u = sign | 0x7f800000 | (mant << 13);
+    } else if (exp) {
+	x.u = sign | ((exp + 112) << 23) | (mant << 13);
+    } else {
+	x.f = (float) mant * (1.0f / 16777216.0f);
+	x.u |= sign;
+    }
+    return x.f;
+}
+
+static inline unsigned int SmokeDead(const SmokeV *s, int i, int k)
+{
+    return s->state[i*4+k] >> SMOKE_DEAD_SHIFT;
+}
+
+static inline void SmokeSetDead(SmokeV *s, int i, int k, unsigned int dead)
+{
+    s->state[i*4+k] = (s->state[i*4+k] & SMOKE_FRAME_MASK) | (dead << SMOKE_DEAD_SHIFT);
+}
+
+static inline int SmokeFrame(const SmokeV *s, int i, int k)
+{
+    return s->state[i*4+k] & SMOKE_FRAME_MASK;
+}
+
+static inline void SmokeSetFrame(SmokeV *s, int i, int k, int frame)
+{
+    s->state[i*4+k] = (s->state[i*4+k] & ~SMOKE_FRAME_MASK) | frame;
+}
+
+static inline float SmokeColor(const SmokeV *s, int i, int c, int k)
+{
+    return s->c[i].color[c][k] * (1.0f / 255.0f);
+}
+
+static inline void SmokeSetColor(SmokeV *s, int i, int c, int k, float v)
+{
+    s->c[i].color[c][k] = (unsigned char) (MAX_(0.0f, MIN_(1.0f, v)) * 255.0f + 0.5f);
+}
+
+static inline float SmokeBirth(const SmokeV *s, int i, int k)
+{
+    return (float) (s->timeBase + (double) HalfToFloat(s->c[i].age[k]));
+}
+
+/* t must be within SMOKE_REBASE of timeBase; EmitSmoke sees to that */
+static inline void SmokeSetBirth(SmokeV *s, int i, int k, double t)
+{
+    s->c[i].age[k] = FloatToHalf((float) (t - s->timeBase));
+}
+
+#endif /* FLURRY_COMPACT */
+
+/* Vertex arrays a Draw kernel fills and SubmitSmoke hands to GL.  They
+   are only live between the two, so every flurry shares one set; a
+   slice of a bigger set works the same way. */
+typedef struct SmokeStaging
+{
+        floatToVector *seraphimVertices;	/* 2 per quad */
+        floatToVector *seraphimColors;		/* 4 per quad */
+	float *seraphimTextures;		/* 8 per quad */
+	int quads;				/* room for this many */
+} SmokeStaging;
+
+int InitSmokeStaging(SmokeStaging *st, int quads);
+void FreeSmokeStaging(SmokeStaging *st);
+void SliceSmokeStaging(SmokeStaging *slice, const SmokeStaging *st, int first, int quads);
+
+/* Smoke narrower than global->lodWidth pixels on screen is thinned out:
+   only a share proportional to its width is drawn, brightened to keep
+   the total light the same.  Which particles survive depends only on the
+   particle, so the selection does not shimmer from frame to frame. */
+#define LOD_MIN_KEEP 0.125f
+
+static inline float SmokeLodRand(int index, float birth)
+{
+    union { float f; unsigned int u; } t;
+    unsigned int h;
+
+    t.f = birth;
+    h = (unsigned int) index * 0x9e3779b1u ^ t.u;
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return (float) (h >> 8) * (1.0f / 16777216.0f);
+}
+
 void InitSmoke(SmokeV *s);
+void SetSmokeCap(SmokeV *s, int groups);
 
-void UpdateSmoke_ScalarBase(global_info_t *global, flurry_info_t *flurry, SmokeV *s);
+/* dispatch on global->optMode, or the flurry's stream count for
+   OPT_MODE_AUTO */
+void UpdateSmoke(global_info_t *global, flurry_info_t *flurry, SmokeV *s);
+int DrawSmoke(global_info_t *global, flurry_info_t *flurry, SmokeV *s, SmokeStaging *st, float);
+/* just groups [first, last), into st from its start; the live ones are
+   added to *live rather than left in s->live */
+int DrawSmokeRange(global_info_t *global, flurry_info_t *flurry, SmokeV *s, SmokeStaging *st,
+		   float, int first, int last, int *live);
+/* both in one pass over the particles (global->fusedSmoke) */
+int UpdateDrawSmoke(global_info_t *global, flurry_info_t *flurry, SmokeV *s, SmokeStaging *st, float);
+
+void EmitSmoke(flurry_info_t *flurry, SmokeV *s);
 
-void DrawSmoke_Scalar(global_info_t *global, flurry_info_t *flurry, SmokeV *s, float);
-void DrawSmoke_Vector(global_info_t *global, flurry_info_t *flurry, SmokeV *s, float);
+void UpdateSmoke_ScalarBase(global_info_t *global, flurry_info_t *flurry, SmokeV *s);
+void UpdateSmoke_Vector(global_info_t *global, flurry_info_t *flurry, SmokeV *s);
+void UpdateSmokeRange_Scalar(global_info_t *global, flurry_info_t *flurry, SmokeV *s,
+			     int first, int last);
+void UpdateSmokeRange_Vector(global_info_t *global, flurry_info_t *flurry, SmokeV *s,
+			     int first, int last);
+
+/* The Draw* kernels only fill the staging arrays and return the quad count;
+   SubmitSmoke hands them to GL. */
+int DrawSmoke_Scalar(global_info_t *global, flurry_info_t *flurry, SmokeV *s, SmokeStaging *st, float);
+int DrawSmoke_Vector(global_info_t *global, flurry_info_t *flurry, SmokeV *s, SmokeStaging *st, float);
+int DrawSmokeRange_Scalar(global_info_t *global, flurry_info_t *flurry, SmokeV *s, SmokeStaging *st,
+			  float, int first, int last, int *live);
+int DrawSmokeRange_Vector(global_info_t *global, flurry_info_t *flurry, SmokeV *s, SmokeStaging *st,
+			  float, int first, int last, int *live);
+void SubmitSmoke(SmokeStaging *st, int quads);
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FLURRY_X86_KERNELS
+void UpdateSmoke_VectorAVX2(global_info_t *global, flurry_info_t *flurry, SmokeV *s);
+void UpdateSmoke_VectorAVX512(global_info_t *global, flurry_info_t *flurry, SmokeV *s);
+void UpdateSmokeRange_VectorAVX2(global_info_t *global, flurry_info_t *flurry, SmokeV *s,
+				 int first, int last);
+void UpdateSmokeRange_VectorAVX512(global_info_t *global, flurry_info_t *flurry, SmokeV *s,
+				   int first, int last);
+int DrawSmoke_VectorAVX2(global_info_t *global, flurry_info_t *flurry, SmokeV *s, SmokeStaging *st, float);
+int DrawSmoke_VectorAVX512(global_info_t *global, flurry_info_t *flurry, SmokeV *s, SmokeStaging *st, float);
+int DrawSmokeRange_VectorAVX2(global_info_t *global, flurry_info_t *flurry, SmokeV *s, SmokeStaging *st,
+			      float, int first, int last, int *live);
+int DrawSmokeRange_VectorAVX512(global_info_t *global, flurry_info_t *flurry, SmokeV *s, SmokeStaging *st,
+				float, int first, int last, int *live);
+#endif
+
+/* flurry-prep.c: one flurry's quads built by several threads */
+extern int prepThreads;
+
+/* the caller is one of the threads; with fewer if not all will start */
+int PrepStart(int threads);
+/* as DrawSmoke; -1, with nothing done, if it isn't worth it or the
+   threads are busy with another scene */
+int DrawSmoke_Parallel(global_info_t *global, flurry_info_t *flurry, SmokeV *s,
+		       SmokeStaging *st, float);
+
+/* flurry-field.c: the sparks' pull from a grid, with the close passes
+   exact; within 5% RMS of the exact pull at n = 8 and 3.5% from n = 12.
+   FieldFrom is the fewest streams from which an n^3 grid beats optMode's
+   exact update, timed on first use; UpdateSmoke_Field returns 0, having
+   done nothing, below that. */
+#define FIELD_MAX_GRID 64
+
+int FieldGridValid(int n);
+int FieldFrom(int n, int optMode);
+int FieldPays(const global_info_t *global, const flurry_info_t *flurry);
+int UpdateSmoke_Field(global_info_t *global, flurry_info_t *flurry, SmokeV *s);
+int FieldError(flurry_info_t *flurry, int n, double *rms, float *p99);
 
 typedef struct Star  
 {
@@ -130,8 +440,13 @@ typedef struct Spark
 void UpdateSparkColour(global_info_t *info, flurry_info_t *flurry, Spark *s);
 void InitSpark(Spark *s);
 void UpdateSpark(global_info_t *info, flurry_info_t *flurry, Spark *s);
+void UpdateSparks(global_info_t *info, flurry_info_t *flurry, int count);
 void DrawSpark(global_info_t *info, flurry_info_t *flurry, Spark *s);
 
+/* the path shared by stars and sparks: a point wandering over a
+   `range'-sized lissajous figure, tumbled by two rotations */
+void Trajectory(float range, float cf, double thisAngle, double mystery, float position[3]);
+
 /* UInt8  sys_glBPP=32; */
 /* int SSMODE = FALSE; */
 /* int currentVideoMode = 0; */
@@ -145,11 +460,26 @@ void DrawSpark(global_info_t *info, flurry_info_t *flurry, Spark *s);
 
 #define RandBell(scale) ((scale) * (-(frand(.5) + frand(.5) + frand(.5))))
 
-extern GLuint theTexture;
-
-void MakeTexture(void);
+/* build the smoke texture in the current GL context; returns its name */
+GLuint MakeTexture(FlurryRng *rng);
+/* or just its 256 x 256 luminance, alpha pairs, to be freed */
+GLubyte *MakeTextureData(FlurryRng *rng);
 
 #define OPT_MODE_SCALAR_BASE		0x0
+#define OPT_MODE_VECTOR			0x1	/* 4 lanes, baseline ISA */
+#define OPT_MODE_VECTOR_AVX2		0x2	/* 8 lanes, AVX2 */
+#define OPT_MODE_VECTOR_AVX512		0x3	/* 16 lanes, AVX-512F */
+#define OPT_MODE_MAX			0x4
+/* not a kernel: each flurry gets the one timed fastest for its streams */
+#define OPT_MODE_AUTO			OPT_MODE_MAX
+
+/* flurry-cpu.c: pick the fastest kernel this CPU can run */
+int SelectOptMode(void);
+/* OPT_MODE_AUTO's choice; times the kernels on the first call */
+int OptModeForStreams(int streams);
+int OptModeSupported(int mode);
+int ParseOptMode(const char *name);
+const char *OptModeName(int mode);
 
 typedef enum _ColorModes
 {
@@ -182,14 +512,15 @@ typedef enum _ColorModes
 #define fieldRange 1000.0f
 #define streamBias 7.0f
 
-#define MAX_SPARKS 64
+#define MAX_SPARKS 64		/* a scene's flurries; frames, snapshots and golden files */
+#define MAX_BENCH_SPARKS 256	/* the bench's synthetic flurries, and the kernels' stacks */
 
 struct _flurry_info_t {
 	flurry_info_t *next;
 	ColorModes currentColorMode;
 	SmokeV *s;
 	Star *star;
-	Spark *spark[MAX_SPARKS];
+	Spark *spark;		/* numStreams of them, packed */
 	float streamExpansion;
 	int numStreams;
 	double flurryRandomSeed;
@@ -199,13 +530,50 @@ struct _flurry_info_t {
 	double briteFactor;
 	float drag;
 	int dframe;
+	FlurryRng rng;		/* everything random once the flurry exists */
+	size_t blockSize;	/* of the arena block; 0 if not ours to free */
 };
 
+/* flurry-arena.c: each flurry and its star, sparks and smoke in one block */
+extern int arenaHugePages;
+
+size_t FlurryBlockSize(int streams);
+flurry_info_t *FlurryBlockAlloc(int streams);
+/* point star, spark and s into the block that starts at flurry */
+void FlurryBlockBind(flurry_info_t *flurry);
+void FlurryBlockFree(flurry_info_t *flurry);
+
+/* flurry-governor.c: trades particle count for frame time */
+typedef struct Governor
+{
+	float budget;		/* seconds of work per frame; 0 disables */
+	float average;		/* smoothed work time of recent frames */
+	float quality;		/* fraction of the particle cap in use */
+	int over;		/* consecutive frames over budget */
+	int under;		/* consecutive frames well under budget */
+	int cooldown;		/* frames to let a change settle */
+} Governor;
+
+void GovernorInit(Governor *g, float budget);
+void GovernorUpdate(global_info_t *global, double work);
+
 struct _global_info_t {
   /* system values */
 	GLXContext *glx_context;
 	Window window;
         int optMode;
+	Governor governor;
+	float lodWidth;		/* thin smoke narrower than this (px); 0 = off */
+	float substepRate;	/* split frames longer than 1/substepRate s; 0 = off */
+	int fieldGrid;		/* sample the sparks' pull on n^3 nodes; 0 = exact */
+	int accumulate;		/* the renderer keeps float frames (flurry-accum.c) */
+	int fusedSmoke;		/* SceneStepBuild draws as it updates */
+	SmokeStaging *staging;	/* the harnesses' DrawSmoke target */
+	int preset;
+	FlurryRng rng;		/* for building the flurries */
+	double lastStep;	/* time of the last SceneStep; < 0 before one */
+	double frameDelta;	/* and how far that step went */
+	GLuint texture;		/* the smoke texture, in the renderer's context */
 
 	float sys_glWidth;
 	float sys_glHeight;
@@ -216,6 +584,303 @@ struct _global_info_t {
 #define kNumSpectrumEntries 512
 
 void OTSetup(void);
+/* restart the clock so that it reads `now' seconds since start */
+void OTResume(double now);
 double TimeInSecondsSinceStart(void);
 
+#define DEF_SUBSTEP_RATE 45.0f	/* only frames slower than this are split */
+#define MAX_SUBSTEPS 8
+
+typedef enum _Presets
+{
+	PRESET_UNKNOWN = -2,
+	PRESET_INSANE = -1,
+	PRESET_WATER = 0,
+	PRESET_FIRE,
+	PRESET_PSYCHEDELIC,
+	PRESET_RGB,
+	PRESET_BINARY,
+	PRESET_CLASSIC,
+	PRESET_MAX
+} Presets;
+
+/* "random" draws from the process's random() */
+int ParsePreset(const char *name);
+const char *PresetName(int preset);
+/* returns 0, with no flurries left behind, if it runs out of memory */
+int CreatePreset(global_info_t *global, int preset, double now);
+
+flurry_info_t *new_flurry_info(global_info_t *global, int streams, ColorModes colour, float thickness, float speed, double bf, double now);
+void delete_flurry_info(flurry_info_t *flurry);
+
+/* advance one flurry's simulation to `now' seconds since start */
+void StepFlurry(global_info_t *global, flurry_info_t *flurry, double now);
+/* the same, with the last smoke update drawing into st as it goes
+   (UpdateDrawSmoke); returns the quads */
+int StepDrawFlurry(global_info_t *global, flurry_info_t *flurry, double now,
+		   SmokeStaging *st, float brightness);
+
+/*
+ * flurry-scene.c: libflurry.  A scene (global_info_t) owns its flurries,
+ * their generators and its own idea of time, which only moves when the
+ * caller steps it; nothing in the simulation touches a global.  Scenes
+ * are independent, so a host can step any number of them on as many
+ * threads, as long as each scene is on one thread at a time.  The GL
+ * side stays with the caller: SceneBuild leaves everything to draw in
+ * a SceneFrame.
+ */
+typedef struct SceneFrame
+{
+	SmokeStaging staging;	/* room for NUMSMOKEPARTICLES quads per flurry */
+	int allQuads;		/* packed from the start of staging, */
+	int *quads;		/* flurry by flurry */
+	int *live;
+	Spark *sparks;		/* MAX_SPARKS per flurry */
+	int numFlurries;
+	float alpha;		/* how much of the previous frame to fade */
+} SceneFrame;
+
+/* PRESET_UNKNOWN leaves the scene empty, to be filled by the caller */
+global_info_t *SceneCreate(int preset, float width, float height,
+			   unsigned int seed, double now);
+void SceneResize(global_info_t *scene, float width, float height);
+/* bring every flurry to `now', in the caller's seconds */
+void SceneStep(global_info_t *scene, double now);
+/* the quads for the state the last SceneStep left; returns their number */
+int SceneBuild(global_info_t *scene, SceneFrame *frame);
+/* SceneStep then SceneBuild; with scene->fusedSmoke, in one pass over
+   each flurry's particles, the draw's time then counted as the smoke's */
+int SceneStepBuild(global_info_t *scene, double now, SceneFrame *frame);
+/* the scene's GL texture, if any, is the renderer's to delete */
+void SceneDestroy(global_info_t *scene);
+
+int SceneFrameInit(SceneFrame *frame, const global_info_t *scene);
+void SceneFrameFree(SceneFrame *frame);
+
+/* flurry-snapshot.c: warm start from a mapped copy of the simulation */
+extern int snapshotEnabled;
+
+int SnapshotOpen(const char *path, double interval);
+/* preset is PRESET_UNKNOWN to take whatever the snapshot holds; *now is
+   set to the time the snapshot was taken at */
+int SnapshotLoad(global_info_t *global, int preset, double *now);
+int SnapshotSave(global_info_t *global, double now);
+void SnapshotPoll(global_info_t *global, double now);
+
+/* flurry-pipeline.c: a producer thread filling two frame slots in turn
+   for the render thread */
+typedef struct Pipeline
+{
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int full[2];		/* slot holds a frame not yet drawn */
+	int next;		/* slot the render thread takes next */
+	int busy;		/* producer is filling a slot */
+	int quit;
+	void (*produce)(void *ctx, int slot);
+	void *ctx;
+} Pipeline;
+
+int PipelineStart(Pipeline *p, void (*produce)(void *ctx, int slot), void *ctx);
+int PipelineAcquire(Pipeline *p);
+void PipelineRelease(Pipeline *p, int slot);
+void PipelineIdle(Pipeline *p);
+void PipelineStop(Pipeline *p);
+
+/* flurry-golden.c: headless kernel regression harness */
+int GoldenMain(int argc, char **argv);
+
+/* flurry-replay.c: a session's frame clock, recorded and replayed headless */
+extern int recordEnabled;
+
+int RecordOpen(const char *path);
+/* seed is the scene's generator before the preset was built at `created' */
+void RecordStart(const global_info_t *scene, int preset, const FlurryRng *seed,
+		 double created);
+/* one frame: the time given to SceneStep, the scene's size and the
+   governor's quality at that step, and the particles alive after it */
+void RecordStep(double now, float width, float height, float quality, int live);
+int ReplayMain(int argc, char **argv);
+
+/* flurry-bench.c: headless scaling sweep, CSV on stdout */
+int BenchMain(int argc, char **argv);
+
+/* flurry-profile.c: per-phase frame timing and the showFPS overlay */
+typedef enum _ProfilePhase
+{
+	PHASE_STAR = 0,
+	PHASE_SPARK,
+	PHASE_SMOKE,
+	PHASE_VERTS,
+	PHASE_SUBMIT,
+	PHASE_FADE,
+	PHASE_SWAP,
+	PHASE_FRAME,
+	PHASE_MAX
+} ProfilePhase;
+
+#define PROFILE_MAX_FLURRIES 16
+
+extern int profileEnabled;
+
+double ProfileClock(void);
+double ProfileBegin(ProfilePhase phase);
+void ProfileEnd(ProfilePhase phase, double start);
+void ProfileParticles(int index, int live);
+/* from a thread other than the one that calls ProfileEndFrame, once its
+   share of a frame is done */
+void ProfilePublish(void);
+void ProfileTakeFrame(double phases[PHASE_MAX]);
+void ProfileEndFrame(void);
+void ProfileDrawHUD(Display *dpy, global_info_t *global);
+
+/* flurry-counters.c: perf_event_open counters around the profiled phases */
+typedef enum _CounterKind
+{
+	COUNTER_CYCLES = 0,
+	COUNTER_INSTRUCTIONS,
+	COUNTER_CACHE_MISSES,
+	COUNTER_BRANCH_MISSES,
+	COUNTER_STALLED,	/* backend stall cycles */
+	COUNTER_MAX
+} CounterKind;
+
+/* what the counters say about a stretch of work; -1 where not counted */
+typedef struct CounterRatios
+{
+	double ipc;
+	double missesPerParticle;
+	double branchMissesPerParticle;
+	double stalled;		/* fraction of the cycles */
+} CounterRatios;
+
+extern int countersEnabled;
+
+/* returns 0, and leaves them off, if this thread can't count */
+int CountersOpen(void);
+int CounterAvailable(CounterKind kind);
+void CountersBegin(ProfilePhase phase);
+void CountersEnd(ProfilePhase phase);
+/* the calling thread's counts, for the next frame to be taken */
+void CountersPublish(void);
+/* hand over this frame's per phase counts, from every thread, and start
+   the next */
+void CountersTakeFrame(unsigned long long counts[PHASE_MAX][COUNTER_MAX]);
+void CounterRatiosOf(const unsigned long long counts[COUNTER_MAX],
+		     double particles, CounterRatios *r);
+
+/* flurry-accum.c: accumulate in a float buffer, for any frame rate.  The
+   8 bit look was tuned at ACCUM_RATE fps, fading by alpha = 5 dt and
+   drawing pow(dt, 0.75) * 10 bright; these give the same light per
+   second and the same fade per second at every rate. */
+#define ACCUM_RATE 60.0
+#define ACCUM_DECAY (-ACCUM_RATE * log(1.0 - 5.0 / ACCUM_RATE))	/* per second */
+#define ACCUM_BRITE (10.0 * pow(ACCUM_RATE, 0.25))		/* per second */
+
+typedef struct Accum
+{
+	GLuint fbo;
+	GLuint texture;		/* half float, the whole window */
+	int width, height;
+} Accum;
+
+/* (re)make the buffer; returns 0, with it freed, if the GL can't */
+int AccumResize(Accum *a, int width, int height);
+void AccumFree(Accum *a);
+/* draw into the buffer until AccumEnd puts it on the window */
+void AccumBegin(Accum *a);
+void AccumEnd(Accum *a);
+
+/* flurry-raster.c: the smoke quads drawn on the CPU, for -headless */
+#define RASTER_LEVELS 9		/* mip levels of the smoke texture */
+
+typedef struct Raster
+{
+	int width, height;
+	float *accum;		/* R G B, bottom row first, as GL has it */
+	float *level[RASTER_LEVELS];	/* what each texel adds, 256 >> i a side */
+} Raster;
+
+int RasterInit(Raster *r, int width, int height, FlurryRng *rng);
+void RasterFree(Raster *r);
+/* fade by SceneFrame alpha, then add the quads */
+void RasterFrame(Raster *r, const SmokeStaging *st, int quads, float alpha);
+/* clipped to 8 bits, B G R A, top row first */
+void RasterResolve(const Raster *r, unsigned char *out, int stride);
+
+/* flurry-sink.c: frames in a memfd ring, shared with other processes.
+   The memfd holds a SinkHeader, then from slotOffset `slots' slots of
+   slotSize bytes, each a SinkSlot and from SINK_SLOT_HEADER into it the
+   pixels.  Frame n goes in slot n % slots. */
+#define SINK_MAGIC 0x4b534c46 /* "FLSK" */
+#define SINK_VERSION 1
+#define SINK_SLOT_HEADER 64
+
+typedef struct SinkHeader
+{
+	unsigned int magic;
+	unsigned int version;
+	unsigned int width, height;
+	unsigned int stride;	/* bytes a row: B G R A, top row first */
+	unsigned int slots;
+	unsigned int slotSize;	/* page aligned */
+	unsigned int slotOffset;
+	volatile unsigned int head;	/* frames published; a futex word */
+} SinkHeader;
+
+typedef struct SinkSlot
+{
+	volatile unsigned int seq;	/* odd while being written */
+	unsigned int frame;	/* the head it was published at */
+	double time;		/* the scene's, in seconds */
+} SinkSlot;
+
+extern int sinkEnabled;
+
+/* `path' is the socket consumers get the memfd from */
+int SinkOpen(const char *path, int width, int height, int slots);
+/* where the next frame's pixels go; never blocks */
+unsigned char *SinkBegin(int *stride);
+void SinkPublish(double time);
+
+/* flurry-headless.c: no X, no GL; the CPU rasterizer into the sink */
+int HeadlessMain(int argc, char **argv);
+
+/* flurry-metrics.c: Prometheus text over a Unix socket or a local port */
+typedef struct MetricsSample
+{
+	double interval;	/* since the frame before; 0 if none */
+	double work;		/* simulation and GL time spent on it */
+	int live;		/* particles, every tile */
+	int quads;
+	int dropped;		/* frame ticks missed just before it */
+} MetricsSample;
+
+extern int metricsEnabled;
+
+/* `where' is a socket path, or a port number on 127.0.0.1 */
+int MetricsOpen(const char *where);
+/* never blocks; called from one thread only */
+void MetricsFrame(const MetricsSample *sample);
+
+/* flurry-trace.c: Chrome trace-event timeline */
+extern int traceEnabled;
+
+int TraceOpen(const char *path);
+void TraceThreadName(const char *name);
+/* arg, if not negative, is recorded as args.index (e.g. the flurry) */
+void TraceEvent(const char *name, char ph, double when, int arg);
+void TraceBegin(const char *name, int arg);
+void TraceEnd(const char *name, int arg);
+void TracePoll(void);
+void TraceFlush(void);
+
+/* Cheap enough to leave in the hot path: with neither the profiler nor
+   the tracer running a phase costs two loads and a branch. */
+#define PROFILE_BEGIN(phase, t) \
+	((t) = (profileEnabled | traceEnabled) ? ProfileBegin(phase) : 0.0)
+#define PROFILE_END(phase, t) \
+	do { if (profileEnabled | traceEnabled) ProfileEnd((phase), (t)); } while (0)
+
 #endif /* Include/Define */